@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+##########################################################################
+#                                  _   _ ____  _
+#  Project                     ___| | | |  _ \| |
+#                             / __| | | | |_) | |
+#                            | (__| |_| |  _ <| |___
+#                             \___|\___/|_| \_\_____|
+#
+# Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+#
+# This software is licensed as described in the file COPYING, which
+# you should have received as part of this distribution. The terms
+# are also available at https://curl.se/docs/copyright.html.
+#
+# You may opt to use, copy, modify, merge, publish, distribute and/or sell
+# copies of the Software, and permit persons to whom the Software is
+# furnished to do so, under the terms of the COPYING file.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# SPDX-License-Identifier: curl
+#
+##########################################################################
+
+# Times trurl on a generated URL file for a set of command lines. Use
+# --baseline=[path] to compare against another trurl build, or
+# --compare=[option] to compare with and without an option, like
+# --compare=--io-uring.
+
+import sys
+import random
+import tempfile
+import time
+from os import getcwd, path
+from subprocess import DEVNULL, run
+
+PROGNAME = "trurl"
+NUMURLS = 200000
+ROUNDS = 3
+
+# name, extra arguments
+CASES = [
+    ("default output", []),
+    ("get host", ["-g", "{host}"]),
+    ("get path", ["-g", "{path}"]),
+    ("get query key", ["-g", "{query:id}"]),
+    ("json", ["--json"]),
+    ("sort + qtrim", ["--sort-query", "--qtrim", "utm_*"]),
+    ("output file", ["--output", "{outfile}"]),
+]
+
+
+def generate(filename, count):
+    rnd = random.Random(4711)
+    hosts = ["example.com", "curl.se", "www.example.org", "sub.host.test"]
+    with open(filename, "w") as f:
+        for i in range(count):
+            host = rnd.choice(hosts)
+            # every fourth URL needs normalizing
+            enc = "%41" if not i % 4 else ""
+            f.write(f"https://{host}/path/{i}/page.html"
+                    f"?id={i}&utm_source=x&b={enc}{rnd.randint(0, 999)}"
+                    f"#frag{i % 7}\n")
+
+
+def timeit(cmd, urlfile, outfile):
+    cmd = [arg.replace("{outfile}", outfile) for arg in cmd]
+    best = None
+    for _ in range(ROUNDS):
+        start = time.perf_counter()
+        run(cmd + ["-f", urlfile], stdout=DEVNULL, stderr=DEVNULL)
+        took = time.perf_counter() - start
+        if best is None or took < best:
+            best = took
+    return best
+
+
+def main(argv):
+    trurl = path.join(getcwd(), PROGNAME)
+    baseline = None
+    compare = None
+    count = NUMURLS
+    for arg in argv[1:]:
+        if arg.startswith("--trurl="):
+            trurl = arg[len("--trurl="):]
+        elif arg.startswith("--baseline="):
+            baseline = arg[len("--baseline="):]
+        elif arg.startswith("--compare="):
+            compare = arg[len("--compare="):]
+        elif arg.startswith("--urls="):
+            count = int(arg[len("--urls="):])
+        else:
+            print(f"unknown argument: {arg}", file=sys.stderr)
+            return 1
+
+    with tempfile.TemporaryDirectory() as tmp:
+        urlfile = path.join(tmp, "urls.txt")
+        outfile = path.join(tmp, "out.txt")
+        generate(urlfile, count)
+        print(f"{count} URLs, best of {ROUNDS} rounds")
+        for name, args in CASES:
+            if compare:
+                took = timeit([trurl, compare] + args, urlfile, outfile)
+            else:
+                took = timeit([trurl] + args, urlfile, outfile)
+            line = f"{name:20} {took:8.3f}s {count / took:12.0f} URLs/s"
+            if baseline:
+                base = timeit([baseline] + args, urlfile, outfile)
+                line += f"   baseline {base:8.3f}s  speedup {base / took:5.2f}x"
+            elif compare:
+                base = timeit([trurl] + args, urlfile, outfile)
+                line += f"   without {base:8.3f}s  speedup {base / took:5.2f}x"
+            print(line)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,308 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * Tests for the libtrurl API, run with "make test-lib". The output of the
+ * trurl tool itself is tested by test.py.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtrurl.h"
+
+static int tests;
+static int failed;
+
+/* one option and its argument, NULL ends the list */
+struct opt {
+  const char *option;
+  const char *arg;
+};
+
+static void fail(const char *name, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "FAIL %s: ", name);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+  failed++;
+}
+
+/* a handle with the options, NULL if one of them did not work */
+static TRURL *handle(const char *name, const struct opt *opts)
+{
+  TRURL *t = trurl_init();
+  if(!t) {
+    fail(name, "trurl_init() failed");
+    return NULL;
+  }
+  for(; opts && opts->option; opts++) {
+    TRURLcode rc = trurl_setopt(t, opts->option, opts->arg);
+    if(rc) {
+      fail(name, "trurl_setopt() failed: %s", trurl_strerror(t));
+      trurl_cleanup(t);
+      return NULL;
+    }
+  }
+  return t;
+}
+
+/* process 'url' and compare the return code and the whole output */
+static void process(const char *name, TRURL *t, const char *url,
+                    TRURLcode code, const char *expect)
+{
+  struct trurl_buf out = { NULL, 0 };
+  TRURLcode rc = trurl_process(t, url, strlen(url), &out);
+  tests++;
+  if(rc != code)
+    fail(name, "returned %d instead of %d (%s)", (int)rc, (int)code,
+         trurl_strerror(t));
+  else if(strcmp(out.data ? out.data : "", expect))
+    fail(name, "output: %s", out.data ? out.data : "");
+  else if(out.len != strlen(expect))
+    fail(name, "wrong output length");
+  free(out.data);
+}
+
+/* a handle with the options, processing the URL */
+static void one(const char *name, const struct opt *opts, const char *url,
+                TRURLcode code, const char *expect)
+{
+  TRURL *t = handle(name, opts);
+  if(t) {
+    process(name, t, url, code, expect);
+    trurl_cleanup(t);
+  }
+}
+
+/* the option is refused by trurl_setopt() */
+static void refused(const char *name, const char *option, const char *arg,
+                    TRURLcode code)
+{
+  TRURL *t = trurl_init();
+  TRURLcode rc;
+  tests++;
+  if(!t) {
+    fail(name, "trurl_init() failed");
+    return;
+  }
+  rc = trurl_setopt(t, option, arg);
+  if(rc != code)
+    fail(name, "%s returned %d instead of %d", option, (int)rc, (int)code);
+  else if(!trurl_strerror(t)[0])
+    fail(name, "no error message");
+  trurl_cleanup(t);
+}
+
+static void success(void)
+{
+  static const struct opt get[] = {
+    { "--get", "{host} {query:a}" }, { NULL, NULL }
+  };
+  static const struct opt set[] = {
+    { "--set", "port=8080" }, { "--append", "path=index.html" },
+    { NULL, NULL }
+  };
+  static const struct opt json[] = {
+    { "--json", NULL }, { NULL, NULL }
+  };
+  static const struct opt iter[] = {
+    { "--iterate", "host=a b" }, { NULL, NULL }
+  };
+  one("get", get, "https://example.com/?a=1", TRURLE_OK, "example.com 1\n");
+  one("set", set, "http://example.com/", TRURLE_OK,
+      "http://example.com:8080/index.html\n");
+  one("no options", NULL, "example.com", TRURLE_OK, "http://example.com/\n");
+  one("iterate", iter, "ftp://x/", TRURLE_OK, "ftp://a/\nftp://b/\n");
+  /* each output is a complete JSON value */
+  one("json", json, "https://example.com/", TRURLE_OK,
+      "[\n  {\n"
+      "    \"url\": \"https://example.com/\",\n"
+      "    \"parts\": {\n"
+      "      \"scheme\": \"https\",\n"
+      "      \"host\": \"example.com\",\n"
+      "      \"path\": \"/\"\n"
+      "    }\n"
+      "  }\n"
+      "]\n");
+}
+
+static void errors(void)
+{
+  static const struct opt set[] = {
+    { "--set", "nope=x" }, { NULL, NULL }
+  };
+  static const struct opt url[] = {
+    { "--verify", NULL }, { "--set", "scheme=" }, { "--set", "host=" },
+    { "--set", "path=" }, { NULL, NULL }
+  };
+  static const struct opt badurl[] = {
+    { "--verify", NULL }, { NULL, NULL }
+  };
+  static const struct opt get[] = {
+    { "--get", "{host} {nope}" }, { NULL, NULL }
+  };
+  static const struct opt iter[] = {
+    { "--iterate", "nope=a b" }, { NULL, NULL }
+  };
+  static const struct opt setup[] = {
+    { "--input-json-rewrite", NULL }, { NULL, NULL }
+  };
+
+  refused("append", "--append", "nope=x", TRURLE_APPEND);
+  refused("arg", "--get", NULL, TRURLE_ARG);
+  refused("flag", "--nope", NULL, TRURLE_FLAG);
+  refused("trim", "--trim", "nope=x", TRURLE_TRIM);
+  refused("repl", "--replace", NULL, TRURLE_REPL);
+  refused("help", "--help", NULL, TRURLE_FLAG);
+
+  one("set", set, "https://example.com/", TRURLE_SET, "");
+  one("url", url, "https://example.com/", TRURLE_URL, "");
+  one("badurl", badurl, "https://ex ample.com/", TRURLE_BADURL, "");
+  one("get", get, "https://example.com/", TRURLE_GET, "");
+  one("iter", iter, "https://example.com/", TRURLE_ITER, "");
+  /* setupoptions() fails on the first URL */
+  one("setup", setup, "https://example.com/", TRURLE_FLAG, "");
+}
+
+/* the options that use files are refused */
+static void files(void)
+{
+  refused("url-file", "--url-file", "urls.txt", TRURLE_FLAG);
+  refused("url-file=", "--url-file=urls.txt", NULL, TRURLE_FLAG);
+  refused("-f", "-furls.txt", NULL, TRURLE_FLAG);
+  refused("output", "--output", "out.txt", TRURLE_FLAG);
+  refused("-o", "-o", "out.txt", TRURLE_FLAG);
+  refused("rules", "--rules", "rules.txt", TRURLE_FLAG);
+  refused("html", "--html", "page.html", TRURLE_FLAG);
+  refused("checkpoint", "--checkpoint", "cp", TRURLE_FLAG);
+  refused("pipeline", "--pipeline", NULL, TRURLE_FLAG);
+  refused("coprocess", "--coprocess", "line", TRURLE_FLAG);
+  refused("serve", "--serve", "socket", TRURLE_FLAG);
+}
+
+/* a handle works on one URL after the other, errors or not */
+static void reuse(void)
+{
+  static const struct opt get[] = {
+    { "--verify", NULL }, { "--get", "{host}" }, { NULL, NULL }
+  };
+  static const struct opt set[] = {
+    { "--set", "host=example.org" }, { NULL, NULL }
+  };
+  struct trurl_buf out = { NULL, 0 };
+  TRURL *t = handle("reuse", get);
+  if(t) {
+    process("reuse 1", t, "https://one.example/", TRURLE_OK,
+            "one.example\n");
+    process("reuse 2", t, "https://[bad/", TRURLE_BADURL, "");
+    process("reuse 3", t, "https://three.example/", TRURLE_OK,
+            "three.example\n");
+
+    /* the output is added to what is in the buffer, a failed URL adds
+       nothing */
+    tests++;
+    if(trurl_process(t, "https://a.example/", 18, &out) ||
+       (trurl_process(t, "https://[bad/", 13, &out) != TRURLE_BADURL) ||
+       trurl_process(t, "https://b.example/", 18, &out) ||
+       strcmp(out.data, "a.example\nb.example\n") || (out.len != 20))
+      fail("append", "output: %s", out.data ? out.data : "");
+    free(out.data);
+
+    /* options cannot be set once the work has started */
+    tests++;
+    if(trurl_setopt(t, "--json", NULL) != TRURLE_FLAG)
+      fail("late option", "was accepted");
+    trurl_cleanup(t);
+  }
+
+  t = handle("reuse set", set);
+  if(t) {
+    process("reuse set 1", t, "https://a.example/", TRURLE_OK,
+            "https://example.org/\n");
+    process("reuse set 2", t, "ftp://b.example/x", TRURLE_OK,
+            "ftp://example.org/x\n");
+    trurl_cleanup(t);
+  }
+}
+
+/* the arguments are copied, the buffers they were in can go away */
+static void arguments(void)
+{
+  static const char *const opts[] = {
+    "--get", "{host}{path}",
+    "--set", "path=/hello",
+    "--redirect", "../other",
+    "--replace", "a=2",
+    NULL
+  };
+  TRURL *t = trurl_init();
+  int i;
+  if(!t) {
+    fail("arguments", "trurl_init() failed");
+    return;
+  }
+  for(i = 0; opts[i]; i += 2) {
+    char *option = strdup(opts[i]);
+    char *arg = strdup(opts[i + 1]);
+    TRURLcode rc;
+    if(!option || !arg) {
+      fail("arguments", "out of memory");
+      free(option);
+      free(arg);
+      trurl_cleanup(t);
+      return;
+    }
+    rc = trurl_setopt(t, option, arg);
+    /* overwrite before freeing, in case the memory is not reused */
+    memset(option, 'x', strlen(option));
+    memset(arg, 'x', strlen(arg));
+    free(option);
+    free(arg);
+    if(rc) {
+      fail("arguments", "trurl_setopt() failed: %s", trurl_strerror(t));
+      trurl_cleanup(t);
+      return;
+    }
+  }
+  process("arguments", t, "https://example.com/dir/page?a=1", TRURLE_OK,
+          "example.com/hello\n");
+  trurl_cleanup(t);
+}
+
+int main(void)
+{
+  success();
+  errors();
+  files();
+  reuse();
+  arguments();
+  printf("%d tests, %d failed\n", tests, failed);
+  return failed ? 1 : 0;
+}
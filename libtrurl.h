@@ -0,0 +1,96 @@
+#ifndef TRURL_LIBTRURL_H
+#define TRURL_LIBTRURL_H
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * libtrurl does what the trurl tool does to a URL, from within a program.
+ * A TRURL handle holds a set of options, given one by one the way they are
+ * given on the trurl command line. trurl_process() then works on one URL at
+ * a time and adds the output trurl would show to a buffer.
+ *
+ * The functions never exit the program, errors are returned as the same
+ * codes trurl exits with. A handle must only be used by one thread at a
+ * time, but different threads can use handles of their own. libcurl must
+ * be version 7.84.0 or later for trurl_init() to be thread-safe.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct trurl TRURL;
+
+typedef enum {
+  TRURLE_OK = 0,
+  TRURLE_FILE = 1,    /* a file problem */
+  TRURLE_APPEND = 2,  /* --append mistake */
+  TRURLE_ARG = 3,     /* an option misses its argument */
+  TRURLE_FLAG = 4,    /* an option mistake */
+  TRURLE_SET = 5,     /* a --set problem */
+  TRURLE_MEM = 6,     /* out of memory */
+  TRURLE_URL = 7,     /* could not get a URL out of the set components */
+  TRURLE_TRIM = 8,    /* a --qtrim problem */
+  TRURLE_BADURL = 9,  /* --verify is set and the URL cannot parse */
+  TRURLE_GET = 10,    /* bad --get syntax */
+  TRURLE_ITER = 11,   /* bad --iterate syntax */
+  TRURLE_REPL = 12,   /* a --replace problem */
+  TRURLE_RULES = 13,  /* a --rules problem */
+  TRURLE_OUTPUT = 14  /* an output problem */
+} TRURLcode;
+
+/* output from trurl_process(), start with both fields zero. 'data' is zero
+   terminated, free it with free() when done */
+struct trurl_buf {
+  char *data;
+  size_t len;
+};
+
+/* a new handle with no options set, NULL when out of memory */
+TRURL *trurl_init(void);
+
+/* set an option like on the command line, for example "--get" and
+   "{host}". 'arg' is NULL for options without argument and is copied.
+   Options that read or write files, like --url-file, --output and --rules,
+   return TRURLE_FLAG. */
+TRURLcode trurl_setopt(TRURL *t, const char *option, const char *arg);
+
+/* work on the URL of 'len' bytes and append the output to 'out'. With
+   --input-format, the URL is a row in that format. With --json, the output
+   is a JSON array of its own. Nothing is appended when it fails. */
+TRURLcode trurl_process(TRURL *t, const char *url, size_t len,
+                        struct trurl_buf *out);
+
+/* the message of the most recent error or note */
+const char *trurl_strerror(TRURL *t);
+
+void trurl_cleanup(TRURL *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,6 +27,12 @@ import sys
 from os import getcwd, path
 import json
 import shlex
+import shutil
+import signal
+import socket
+import tempfile
+import threading
+import time
 from subprocess import PIPE, run, Popen
 from dataclasses import dataclass, asdict
 from typing import Any, Optional, TextIO
@@ -82,6 +88,8 @@ class TestCase:
         self.runnerCmd = runnerCmd
         self.baseCmd = baseCmd
         self.arguments = testCase["input"]["arguments"]
+        # fed to the standard input when set
+        self.stdin = testCase["input"].get("stdin")
         self.expected = testCase["expected"]
         self.commandOutput: CommandOutput = None
         self.testPassed: bool = False
@@ -102,6 +110,7 @@ class TestCase:
 
         output = run(
             cmd + args,
+            input=self.stdin,
             stdout=PIPE, stderr=PIPE,
             encoding="utf-8"
         )
@@ -176,6 +185,166 @@ class TestCase:
             self._printConcise(output)
 
 
+# --serve is tested over its socket, with a trurl running in the background
+class ServeTest:
+    def __init__(self, name, baseCmd, sockPath):
+        self.name = name
+        self.baseCmd = baseCmd
+        self.sockPath = sockPath
+        self.proc = None
+        self.signaled = False
+
+    def start(self, args):
+        self.proc = Popen([self.baseCmd, "--serve", self.sockPath] + args,
+                          stdout=PIPE, stderr=PIPE)
+        for _ in range(500):
+            if path.exists(self.sockPath) or self.proc.poll() is not None:
+                break
+            time.sleep(0.01)
+
+    def connect(self):
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        s.settimeout(10)
+        s.connect(self.sockPath)
+        return s
+
+    def receive(self, s):
+        data = b""
+        while True:
+            more = s.recv(65536)
+            if not more:
+                return data
+            data += more
+
+    # send the requests on a connection of its own, return all responses
+    def request(self, data):
+        with self.connect() as s:
+            s.sendall(data)
+            s.shutdown(socket.SHUT_WR)
+            return self.receive(s)
+
+    def terminate(self):
+        self.proc.send_signal(signal.SIGTERM)
+        self.signaled = True
+
+    # SIGTERM, return the error if trurl did not exit as it should. A
+    # second signal would make it exit at once.
+    def stop(self):
+        if not self.signaled:
+            self.terminate()
+        try:
+            self.proc.wait(timeout=10)
+        except Exception:
+            self.proc.kill()
+            self.proc.wait()
+            return "did not exit on SIGTERM"
+        if self.proc.returncode != 0:
+            return f"exit code {self.proc.returncode}: {self.proc.stderr.read()!r}"
+        if path.exists(self.sockPath):
+            return "the socket was not removed"
+        return None
+
+    def run(self, test):
+        try:
+            error = test(self)
+        except Exception as e:
+            error = repr(e)
+        stopped = self.stop() if self.proc else None
+        error = error or stopped
+        if error:
+            print(f"{RED}serve {self.name}: failed\t{error}{NOCOLOR}",
+                  file=sys.stderr)
+        else:
+            print(f"serve {self.name}: passed")
+        return error is None
+
+
+def expectResponses(got, expected):
+    if got != expected:
+        return f"got {got[:200]!r}, expected {expected[:200]!r}"
+    return None
+
+
+def serveRequests(t):
+    t.start(["-s", "port=81"])
+    return expectResponses(
+        t.request(b"1\t-g\t{host}:{port}\thttps://curl.se/\n"
+                  b"2\thttp://[bad\n"
+                  b"3\t--rules\t/etc/passwd\thttps://curl.se/\n"
+                  b"4\t-o\tserve.txt\thttps://curl.se/\n"
+                  b"5\thttps://curl.se/\n"),
+        b"1\t0\tcurl.se:81\n"
+        b"2\t9\tBad IPv6 address [http://[bad]\n"
+        b"3\t4\tnot allowed in requests: --rules\n"
+        b"4\t4\tnot allowed in requests: -o\n"
+        b"5\t0\thttps://curl.se:81/\n")
+
+
+def serveLength(t):
+    t.start(["--coprocess", "length"])
+    return expectResponses(
+        t.request(b"22\n1\t-g\t{host}\thttps://x/\n"
+                  b"31\n2\t--iterate\thost=a b\thttps://x/\n"),
+        b"6\n1\t0\tx\n\n"
+        b"26\n2\t0\thttps://a/\nhttps://b/\n\n")
+
+
+# clients at the same time, each with requests of its own
+def serveClients(t):
+    errors = []
+
+    def client(n):
+        reqs = b"".join(b"%d\t-g\t{host}\thttps://c%d.example/\n" % (i, n)
+                        for i in range(500))
+        expected = b"".join(b"%d\t0\tc%d.example\n" % (i, n)
+                            for i in range(500))
+        error = expectResponses(t.request(reqs), expected)
+        if error:
+            errors.append(error)
+
+    t.start([])
+    clients = [threading.Thread(target=client, args=(n,)) for n in range(8)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+    return errors[0] if errors else None
+
+
+# SIGTERM sends the responses to the requests that were read
+def serveStop(t):
+    hosts = " ".join(f"h{i}" for i in range(50))
+    ports = " ".join(f"{i}" for i in range(1, 51))
+    # a lot of output for a few requests, more than the socket holds
+    reqs = b"".join(
+        f"{i}\t--iterate\thost={hosts}\t--iterate\tport={ports}\t"
+        f"https://x/{i}\n".encode() for i in range(10))
+    expected = run([t.baseCmd, "--coprocess", "line"], input=reqs,
+                   stdout=PIPE).stdout
+    t.start([])
+    with t.connect() as s:
+        s.sendall(reqs)
+        # the first response is being sent, the rest is waiting
+        got = s.recv(1)
+        t.terminate()
+        got += t.receive(s)
+    return expectResponses(got, expected)
+
+
+def serveTests(baseCmd):
+    tests = [("requests", serveRequests), ("length", serveLength),
+             ("clients", serveClients), ("SIGTERM", serveStop)]
+    tmpDir = tempfile.mkdtemp()
+    passed = 0
+    try:
+        for name, test in tests:
+            t = ServeTest(name, baseCmd, path.join(tmpDir, "trurl.sock"))
+            passed += t.run(test)
+    finally:
+        shutil.rmtree(tmpDir)
+    return passed, len(tests) - passed
+
+
 def main(argc, argv):
     ret = EXIT_SUCCESS
     baseDir = path.dirname(path.realpath(argv[0]))
@@ -267,13 +436,22 @@ def main(argc, argv):
                     test.printDetail(verbose=True, failed=True)
                     numTestsFailed += 1
 
+        numTests = len(testIndexesToRun)
+        # the --serve tests run with all the others
+        if "serve" in features and len(testIndexesToRun) == len(allTests) \
+                and not cmdfilter and not runWithValgrind and runnerCmd == "":
+            passed, failed = serveTests(baseCmd)
+            numTestsPassed += passed
+            numTestsFailed += failed
+            numTests += passed + failed
+
         # finally print the results to terminal
         print("Finished:")
         result = ", ".join([
             f"Failed: {numTestsFailed}",
             f"Passed: {numTestsPassed}",
             f"Skipped: {numTestsSkipped}",
-            f"Total: {len(testIndexesToRun)}"
+            f"Total: {numTests}"
         ])
         if (numTestsFailed == 0):
             print("Passed! - ", result)
@@ -21,6 +21,9 @@
  * SPDX-License-Identifier: curl
  *
  ***************************************************************************/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for fopencookie() */
+#endif
 
 #include <errno.h>
 #include <stdio.h>
@@ -29,6 +32,8 @@
 #include <curl/curl.h>
 #include <curl/mprintf.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
 typedef enum {
@@ -42,11 +47,69 @@ typedef enum {
 #endif
 
 #include <locale.h> /* for setlocale() */
+#include <setjmp.h>
 
 #include "version.h"
+#include "libtrurl.h"
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB_H
+#include <bzlib.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include <time.h>
+#ifndef _MSC_VER
+#include <dirent.h>
+#include <glob.h>
+#include <unistd.h> /* for fsync() and truncate() */
+#include <poll.h>
+#define SUPPORTS_FOLLOW
+#define SUPPORTS_COPROCESS
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#define SUPPORTS_INOTIFY
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define SUPPORTS_IO_URING
+#endif
+#endif
+#endif
+
+#if defined(__linux__) && (defined(HAVE_ZLIB_H) || defined(HAVE_ZSTD_H))
+#define SUPPORTS_COMPRESSED_OUTPUT
+#endif
+
+#if defined(__linux__) && defined(HAVE_PTHREAD_H) && !defined(TRURL_LIBRARY)
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define SUPPORTS_PIPELINE
+#define SUPPORTS_SERVE
+#endif
 
 #ifdef _MSC_VER
 #define strdup _strdup
+#define fileno _fileno
+/* 64-bit offsets, like with _FILE_OFFSET_BITS elsewhere */
+#define fseeko _fseeki64
+#define off_t __int64
+#endif
+
+#ifndef S_ISREG
+#define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
 #endif
 
 #if CURL_AT_LEAST_VERSION(7,77,0)
@@ -54,6 +117,8 @@ typedef enum {
 #endif
 #if CURL_AT_LEAST_VERSION(7,81,0)
 #define SUPPORTS_ZONEID
+#else
+#define CURLUE_BAD_HOSTNAME CURLUE_MALFORMED_INPUT
 #endif
 #if CURL_AT_LEAST_VERSION(7,80,0)
 #define SUPPORTS_URL_STRERROR
@@ -63,12 +128,6 @@ typedef enum {
 #else
 #define CURLU_ALLOW_SPACE 0
 #endif
-#if CURL_AT_LEAST_VERSION(7,88,0)
-#define SUPPORTS_PUNYCODE
-#endif
-#if CURL_AT_LEAST_VERSION(8,3,0)
-#define SUPPORTS_PUNY2IDN
-#endif
 #if CURL_AT_LEAST_VERSION(7,30,0)
 #define SUPPORTS_IMAP_OPTIONS
 #endif
@@ -136,19 +195,21 @@ static const struct var variables[] = {
 #define ERROR_PREFIX PROGNAME " error: "
 #define WARN_PREFIX PROGNAME " note: "
 
-/* error codes */
-#define ERROR_FILE   1
-#define ERROR_APPEND 2 /* --append mistake */
-#define ERROR_ARG    3 /* a command line option misses its argument */
-#define ERROR_FLAG   4 /* a command line flag mistake */
-#define ERROR_SET    5 /* a --set problem */
-#define ERROR_MEM    6 /* out of memory */
-#define ERROR_URL    7 /* could not get a URL out of the set components */
-#define ERROR_TRIM   8 /* a --qtrim problem */
-#define ERROR_BADURL 9 /* if --verify is set and the URL cannot parse */
-#define ERROR_GET   10 /* bad --get syntax */
-#define ERROR_ITER  11 /* bad --iterate syntax */
-#define ERROR_REPL  12 /* a --replace problem */
+/* error codes, the same as returned by libtrurl */
+#define ERROR_FILE   TRURLE_FILE
+#define ERROR_APPEND TRURLE_APPEND /* --append mistake */
+#define ERROR_ARG    TRURLE_ARG /* a command line option misses its argument */
+#define ERROR_FLAG   TRURLE_FLAG /* a command line flag mistake */
+#define ERROR_SET    TRURLE_SET /* a --set problem */
+#define ERROR_MEM    TRURLE_MEM /* out of memory */
+#define ERROR_URL    TRURLE_URL /* no URL out of the set components */
+#define ERROR_TRIM   TRURLE_TRIM /* a --qtrim problem */
+#define ERROR_BADURL TRURLE_BADURL /* --verify is set and the URL is bad */
+#define ERROR_GET    TRURLE_GET /* bad --get syntax */
+#define ERROR_ITER   TRURLE_ITER /* bad --iterate syntax */
+#define ERROR_REPL   TRURLE_REPL /* a --replace problem */
+#define ERROR_RULES  TRURLE_RULES /* a --rules problem */
+#define ERROR_OUTPUT TRURLE_OUTPUT /* a --output problem */
 
 #ifndef SUPPORTS_URL_STRERROR
 /* provide a fake local mockup */
@@ -183,6 +244,16 @@ static const unsigned char touppermap[256] = {
    behavior is altered by the current locale. */
 #define raw_toupper(in) touppermap[(unsigned int)in]
 
+/* the unusual thing here is that we let '*' remain as-is */
+#define ISURLPUNTCS(x) (((x) == '-') || ((x) == '.') || ((x) == '_') || \
+                        ((x) == '~') || ((x) == '*'))
+#define ISUPPER(x)  (((x) >= 'A') && ((x) <= 'Z'))
+#define ISLOWER(x)  (((x) >= 'a') && ((x) <= 'z'))
+#define ISDIGIT(x)  (((x) >= '0') && ((x) <= '9'))
+#define ISALPHA(x)  (ISLOWER(x) || ISUPPER(x))
+#define ISALNUM(x)  (ISDIGIT(x) || ISALPHA(x))
+#define ISUNRESERVED(x) (ISALNUM(x) || ISURLPUNTCS(x))
+
 /*
  * casecompare() does ASCII based case insensitive checks, as a strncasecmp
  * replacement.
@@ -218,14 +289,6 @@ static void warnf_low(const char *fmt, va_list ap)
   message_low(WARN_PREFIX, "\n", fmt, ap);
 }
 
-static void warnf(const char *fmt, ...)
-{
-  va_list ap;
-  va_start(ap, fmt);
-  warnf_low(fmt, ap);
-  va_end(ap);
-}
-
 static void help(void)
 {
   int i;
@@ -234,15 +297,32 @@ static void help(void)
     "  -a, --append [component]=[data]  - append data to component\n"
     "      --accept-space               - give in to this URL abuse\n"
     "      --as-idn                     - encode hostnames in idn\n"
+    "      --base [URL]                 - resolve URLs relative to this\n"
+    "      --checkpoint [file]          - save how far --url-file is done\n"
+    "      --coprocess [line/length]    - answer requests framed on stdin\n"
     "      --curl                       - only schemes supported by libcurl\n"
     "      --default-port               - add known default ports\n"
-    "  -f, --url-file [file/-]          - read URLs from file or stdin\n"
+    "      --extract                    - find URLs in text\n"
+    "  -f, --url-file [file/dir/-]      - read URLs from file(s) or stdin\n"
+    "      --follow                     - read the --url-file as it grows\n"
     "  -g, --get [{component}s]         - output component(s)\n"
     "  -h, --help                       - this help\n"
+    "      --html [file/-]              - links in HTML from file or stdin\n"
+    "      --input-format [format]      - tsv, csv, combined, nginx-json,\n"
+    "                                     w3c, warc or pcap\n"
+    "      --input-json-field [name]    - URLs from this NDJSON field\n"
+    "      --input-json-rewrite         - output NDJSON with the field set\n"
+    "      --input-range [start]:[end]  - only the lines in this byte range\n"
+    "      --io-uring                   - read and write files with io_uring\n"
     "      --iterate [component]=[list] - create multiple URL outputs\n"
     "      --json                       - output URL as JSON\n"
+    "      --keep-file-order            - process --url-files in order\n"
     "      --keep-port                  - keep known default ports\n"
     "      --no-guess-scheme            - require scheme in URLs\n"
+    "  -o, --output [file]              - write output to file\n"
+    "      --output-thread              - compress output in a thread\n"
+    "      --part [i]/[n]               - only part i of n of the input\n"
+    "      --pipeline                   - read, process and write in threads\n"
     "      --punycode                   - encode hostnames in punycode\n"
     "      --qtrim [what]               - trim the query\n"
     "      --query-separator [letter]   - if something else than '&'\n"
@@ -250,12 +330,17 @@ static void help(void)
     "      --redirect [URL]             - redirect to this\n"
     "      --replace [data]             - replaces a query [data]\n"
     "      --replace-append [data]      - appends a new query if not found\n"
+    "      --resume                     - continue from the --checkpoint\n"
+    "      --rules [file]               - apply rules from file\n"
+    "      --serve [socket]             - answer requests on a Unix socket\n"
     "  -s, --set [component]=[data]     - set component content\n"
     "      --sort-query                 - alpha-sort the query pairs\n"
     "      --url [URL]                  - URL to work with\n"
+    "      --url-column [number]        - the column with the URL\n"
     "      --urlencode                  - show components URL encoded\n"
     "  -v, --version                    - show version\n"
     "      --verify                     - return error on (first) bad URL\n"
+    "  -z, --null                       - NUL separated input and output\n"
     " URL COMPONENTS:\n"
     "  ", stdout);
   fputs("url, ", stdout);
@@ -269,11 +354,6 @@ static void help(void)
 static void show_version(void)
 {
   curl_version_info_data *data = curl_version_info(CURLVERSION_NOW);
-  /* puny code isn't guaranteed based on the version, so it must be polled
-   * from libcurl */
-#if defined(SUPPORTS_PUNYCODE) || defined(SUPPORTS_PUNY2IDN)
-  bool supports_puny = (data->features & CURL_VERSION_IDN) != 0;
-#endif
 #if defined(SUPPORTS_IMAP_OPTIONS)
   bool supports_imap = false;
   const char *const *protocol_name = data->protocols;
@@ -286,9 +366,24 @@ static void show_version(void)
   fprintf(stdout, "%s version %s libcurl/%s [built-with %s]\n",
           PROGNAME, TRURL_VERSION_TXT, data->version, LIBCURL_VERSION);
   fprintf(stdout, "features:");
+#ifdef HAVE_BZLIB_H
+  fprintf(stdout, " bzip2");
+#endif
+#ifdef SUPPORTS_COMPRESSED_OUTPUT
+  fprintf(stdout, " compressed-output");
+#endif
+#ifdef SUPPORTS_COPROCESS
+  fprintf(stdout, " coprocess");
+#endif
 #ifdef SUPPORTS_GET_EMPTY
   fprintf(stdout, " get-empty");
 #endif
+#ifdef HAVE_ZLIB_H
+  fprintf(stdout, " gzip");
+#endif
+#ifdef SUPPORTS_IO_URING
+  fprintf(stdout, " io-uring");
+#endif
 #ifdef SUPPORTS_IMAP_OPTIONS
   if(supports_imap)
     fprintf(stdout, " imap-options");
@@ -299,14 +394,15 @@ static void show_version(void)
 #ifdef SUPPORTS_NORM_IPV4
   fprintf(stdout, " normalize-ipv4");
 #endif
-#ifdef SUPPORTS_PUNYCODE
-  if(supports_puny)
-    fprintf(stdout, " punycode");
+#ifdef SUPPORTS_PIPELINE
+  fprintf(stdout, " pipeline");
 #endif
-#ifdef SUPPORTS_PUNY2IDN
-  if(supports_puny)
-    fprintf(stdout, " punycode2idn");
+#ifdef SUPPORTS_SERVE
+  fprintf(stdout, " serve");
 #endif
+  /* punycode conversions are built-in */
+  fprintf(stdout, " punycode");
+  fprintf(stdout, " punycode2idn");
 #ifdef SUPPORTS_URL_STRERROR
   fprintf(stdout, " url-strerror");
 #endif
@@ -316,11 +412,70 @@ static void show_version(void)
 #ifdef SUPPORTS_ZONEID
   fprintf(stdout, " zone-id");
 #endif
+#ifdef HAVE_ZSTD_H
+  fprintf(stdout, " zstd");
+#endif
 
   fprintf(stdout, "\n");
   exit(0);
 }
 
+#define MAX_FASTSEGS 32
+
+/* a --get format that only uses plain {component} expansions */
+struct fastseg {
+  size_t litoff; /* literal text in front of the component */
+  size_t litlen;
+  int part; /* -1 for the trailing text */
+};
+
+struct fastfmt {
+  char *lit;
+  int nseg;
+  struct fastseg seg[MAX_FASTSEGS];
+};
+
+#define INPUT_LINES 0 /* default, one URL per line */
+#define INPUT_TSV   1
+#define INPUT_CSV   2
+#define INPUT_JSON  3 /* --input-json-field */
+#define INPUT_COMBINED 4 /* access logs from here on */
+#define INPUT_NGINX 5
+#define INPUT_W3C   6
+#define INPUT_WARC  7 /* records from a --url-file */
+#define INPUT_PCAP  8
+
+#define COPROCESS_LINE   1 /* --coprocess requests, one per line */
+#define COPROCESS_LENGTH 2 /* each after a line with its length */
+
+#define MAX_FIELDS 256
+
+struct row {
+  const char *line; /* the row as read */
+  size_t len;
+  const char *url; /* the URL in the row, NULL if none */
+  size_t prelen;   /* the part of the row before the URL */
+  size_t postoff;  /* where the part after the URL starts */
+  bool keep;       /* output the row around the URL */
+  char sep;
+  size_t nfields;
+  const char *raw[MAX_FIELDS]; /* each field as in the row */
+  size_t rawlen[MAX_FIELDS];
+  const char *value[MAX_FIELDS]; /* unquoted and zero terminated */
+  char *buf; /* for the values */
+  size_t bufsize;
+  char *ubuf; /* for a URL put together from log fields */
+  size_t ubufsize;
+  size_t nraw; /* fields in a W3C log line */
+  char *names; /* the W3C #Fields */
+  const char *fieldname[MAX_FIELDS];
+  size_t nnames;
+  bool skip; /* not a log entry */
+  FILE *cell; /* a --get value to add as a CSV field */
+  char *cellbuf;
+  size_t cellsize;
+};
+
 struct iterinfo {
   CURLU *uh;
   const char *part;
@@ -329,6 +484,8 @@ struct iterinfo {
   unsigned int varmask; /* sets 1 << [component] */
 };
 
+#define MAX_QPAIRS 1000
+
 struct option {
   struct curl_slist *url_list;
   struct curl_slist *append_path;
@@ -337,11 +494,16 @@ struct option {
   struct curl_slist *trim_list;
   struct curl_slist *iter_list;
   struct curl_slist *replace_list;
+  struct ruleset *rules;
   const char *redirect;
+  const char *base;
+  CURLU *baseuh; /* --base parsed once */
+  char *pairbase; /* the most recent base from a base<TAB>relative line */
+  CURLU *pairuh;
   const char *qsep;
   const char *format;
-  FILE *url;
-  bool urlopen;
+  struct curl_slist *url_files; /* --url-file names */
+  FILE *url; /* the --url-file being read */
   bool jsonout;
   bool verify;
   bool accept_space;
@@ -356,16 +518,82 @@ struct option {
   bool end_of_options;
   bool quiet_warnings;
   bool force_replace;
+  unsigned int outparts; /* components the output may show, 1 << part */
+  struct fastfmt *fastget; /* --get format for the fast path */
+  bool fastpath; /* simple URLs can skip libcurl */
+  struct urlreader *reader; /* for the --url-file */
+  FILE *out; /* stdout or the --output file */
+  char delim; /* record separator, newline or NUL with --null */
+  int input; /* INPUT_* */
+  size_t url_column; /* 1 - MAX_FIELDS */
+  struct row *row; /* the current row with --input-format */
+  const char *output;
+  bool output_thread;
+  const char *json_field;
+  bool json_rewrite;
+  bool keep_file_order;
+  bool ranged; /* --input-range or --part */
+  unsigned long long range_start;
+  unsigned long long range_end; /* zero for no end */
+  unsigned long part; /* --part, 1 - parts */
+  unsigned long parts;
+  const char *checkpoint; /* --checkpoint file name */
+  bool resume;
+  unsigned long long resume_offset; /* from the checkpoint */
+  unsigned long long records; /* records read from the --url-file */
+  unsigned long long outsize; /* --output size at the checkpoint */
+  bool outsized; /* outsize is known */
+  time_t checkpointed; /* when the last checkpoint was saved */
+  unsigned long long checkpointrecords; /* records at that time */
+  bool follow;
+  bool io_uring;
+  bool pipeline;
+  struct pipeline *pipe; /* while --pipeline threads run */
+  int coprocess; /* COPROCESS_* */
+  const char *serve; /* the Unix socket for --serve */
+  bool extract;
+  bool html;
+  CURLU *htmlbaseuh; /* the <base href> of the --html document */
+  CURLU *extractuh; /* for checking --extract candidates */
+  CURLU *uh; /* the URL being worked on */
+  jmp_buf *jump; /* libtrurl: errors return here instead of exiting */
+  char errmsg[256]; /* libtrurl: the most recent error or note */
+  int errcode; /* libtrurl: the error jumped back with */
+  struct string qpairs[MAX_QPAIRS]; /* encoded */
+  struct string qpairsdec[MAX_QPAIRS]; /* decoded */
+  int nqpairs; /* how many is stored */
 
   /* -- stats -- */
   unsigned int urls;
 };
 
+/* libtrurl keeps the message instead of showing it, returns true if so */
+static bool libmessage(struct option *o, const char *fmt, va_list ap)
+{
+  if(!o || !o->jump)
+    return false;
+  curl_mvsnprintf(o->errmsg, sizeof(o->errmsg), fmt, ap);
+  return true;
+}
+
+static void warnf(struct option *o, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  if(!libmessage(o, fmt, ap))
+    warnf_low(fmt, ap);
+  va_end(ap);
+}
+
 static void trurl_warnf(struct option *o, const char *fmt, ...)
 {
   if(!o->quiet_warnings) {
     va_list ap;
     va_start(ap, fmt);
+    if(libmessage(o, fmt, ap)) {
+      va_end(ap);
+      return;
+    }
     fputs(WARN_PREFIX, stderr);
     vfprintf(stderr, fmt, ap);
     fputs("\n", stderr);
@@ -373,22 +601,62 @@ static void trurl_warnf(struct option *o, const char *fmt, ...)
   }
 }
 
-#define MAX_QPAIRS 1000
-struct string qpairs[MAX_QPAIRS]; /* encoded */
-struct string qpairsdec[MAX_QPAIRS]; /* decoded */
-int nqpairs; /* how many is stored */
+static void rulesfree(struct ruleset *rs);
+static void rulesload(struct option *o, const char *file);
+static void rowvalue(struct option *o, const char *value);
+static void showlog(struct option *o, FILE *stream, const char *name,
+                    size_t nlen);
+#ifdef SUPPORTS_PIPELINE
+static void pipelinefail(struct option *o, int exit_code, const char *fmt,
+                         va_list ap);
+static void pipelinestop(struct option *o);
+#endif
 
 static void trurl_cleanup_options(struct option *o)
 {
   if(!o)
     return;
+#ifdef SUPPORTS_PIPELINE
+  /* output what the processing got to */
+  pipelinestop(o);
+#endif
+  if(o->row) {
+    if(o->row->cell)
+      fclose(o->row->cell);
+    free(o->row->cellbuf);
+    free(o->row->ubuf);
+    free(o->row->names);
+    free(o->row->buf);
+    free(o->row);
+    o->row = NULL;
+  }
+  if(o->out && (o->out != stdout)) {
+    /* error exit, close what can be closed */
+    fclose(o->out);
+    o->out = NULL;
+  }
+  rulesfree(o->rules);
+  o->rules = NULL;
+  curl_url_cleanup(o->baseuh);
+  curl_url_cleanup(o->pairuh);
+  curl_url_cleanup(o->htmlbaseuh);
+  curl_url_cleanup(o->extractuh);
+  curl_url_cleanup(o->uh);
+  o->uh = NULL;
+  free(o->pairbase);
   curl_slist_free_all(o->url_list);
+  curl_slist_free_all(o->url_files);
   curl_slist_free_all(o->set_list);
   curl_slist_free_all(o->iter_list);
   curl_slist_free_all(o->append_query);
   curl_slist_free_all(o->trim_list);
   curl_slist_free_all(o->replace_list);
   curl_slist_free_all(o->append_path);
+  if(o->fastget) {
+    free(o->fastget->lit);
+    free(o->fastget);
+    o->fastget = NULL;
+  }
 }
 
 static void errorf_low(const char *fmt, va_list ap)
@@ -401,6 +669,16 @@ static void errorf(struct option *o, int exit_code, const char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
+#ifdef SUPPORTS_PIPELINE
+  /* does not return in the --pipeline reader thread */
+  if(o && o->pipe)
+    pipelinefail(o, exit_code, fmt, ap);
+#endif
+  if(libmessage(o, fmt, ap)) {
+    va_end(ap);
+    o->errcode = exit_code;
+    longjmp(*o->jump, 1);
+  }
   errorf_low(fmt, ap);
   va_end(ap);
   trurl_cleanup_options(o);
@@ -421,13 +699,19 @@ static void verify(struct option *o, int exit_code, const char *fmt, ...)
   va_list ap;
   va_start(ap, fmt);
   if(!o->verify) {
-    warnf_low(fmt, ap);
+    if(!libmessage(o, fmt, ap))
+      warnf_low(fmt, ap);
+    va_end(ap);
+  }
+  else if(libmessage(o, fmt, ap)) {
     va_end(ap);
+    o->errcode = exit_code;
+    longjmp(*o->jump, 1);
   }
   else {
     /* make sure to terminate the JSON array */
     if(o->jsonout)
-      printf("%s]\n", o->urls ? "\n" : "");
+      fprintf(o->out, "%s]\n", o->urls ? "\n" : "");
     errorf_low(fmt, ap);
     va_end(ap);
     trurl_cleanup_options(o);
@@ -451,32 +735,111 @@ static void urladd(struct option *o, const char *url)
 }
 
 
-/* read URLs from this file/stdin */
-static void urlfile(struct option *o, const char *file)
+static void listadd(struct curl_slist **list, const char *data)
 {
-  FILE *f;
-  if(o->url)
-    errorf(o, ERROR_FLAG, "only one --url-file is supported");
-  if(strcmp("-", file)) {
-    f = fopen(file, "rt");
-    if(!f)
-      errorf(o, ERROR_FILE, "--url-file %s not found", file);
-    o->urlopen = true;
+  struct curl_slist *n = curl_slist_append(*list, data);
+  if(n)
+    *list = n;
+}
+
+static void urlfile(struct option *o, const char *path);
+
+#ifndef _MSC_VER
+static int namecmp(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* all files in the directory, in name order */
+static void urldir(struct option *o, const char *dir)
+{
+  DIR *d = opendir(dir);
+  size_t dlen = strlen(dir);
+  char **names = NULL;
+  size_t nnames = 0;
+  size_t alloc = 0;
+  size_t i;
+
+  if(!d)
+    errorf(o, ERROR_FILE, "--url-file %s: %s", dir, strerror(errno));
+  if(dlen && (dir[dlen - 1] == '/'))
+    dlen--;
+  for(;;) {
+    struct dirent *e = readdir(d);
+    struct stat st;
+    char *path;
+    if(!e)
+      break;
+    if(e->d_name[0] == '.')
+      /* hidden, or the directory itself */
+      continue;
+    path = malloc(dlen + strlen(e->d_name) + 2);
+    if(!path)
+      errorf(o, ERROR_MEM, "out of memory");
+    curl_msnprintf(path, dlen + strlen(e->d_name) + 2, "%.*s/%s",
+                   (int)dlen, dir, e->d_name);
+    if(stat(path, &st) || !S_ISREG(st.st_mode)) {
+      /* not going into subdirectories */
+      free(path);
+      continue;
+    }
+    if(nnames == alloc) {
+      char **n;
+      alloc = alloc ? alloc * 2 : 64;
+      n = realloc(names, alloc * sizeof(char *));
+      if(!n)
+        errorf(o, ERROR_MEM, "out of memory");
+      names = n;
+    }
+    names[nnames++] = path;
   }
-  else
-    f = stdin;
-  o->url = f;
+  closedir(d);
+  if(nnames)
+    qsort(names, nnames, sizeof(char *), namecmp);
+  for(i = 0; i < nnames; i++) {
+    listadd(&o->url_files, names[i]);
+    free(names[i]);
+  }
+  free(names);
+}
+#endif
+
+/* read URLs from this file/stdin, all files in a directory or the files
+   matching a glob pattern */
+static void urlfile(struct option *o, const char *path)
+{
+  struct stat st;
+  if(!strcmp("-", path)) {
+    listadd(&o->url_files, path);
+    return;
+  }
+  if(stat(path, &st)) {
+#ifndef _MSC_VER
+    glob_t g;
+    size_t i;
+    if(strpbrk(path, "*?[") && !glob(path, 0, NULL, &g)) {
+      for(i = 0; i < g.gl_pathc; i++)
+        urlfile(o, g.gl_pathv[i]);
+      globfree(&g);
+      return;
+    }
+#endif
+    errorf(o, ERROR_FILE, "--url-file %s not found", path);
+  }
+#ifndef _MSC_VER
+  if(S_ISDIR(st.st_mode)) {
+    urldir(o, path);
+    return;
+  }
+#endif
+  listadd(&o->url_files, path);
 }
 
-static void pathadd(struct option *o, const char *path)
+static void pathadd(struct curl_slist **list, const char *path)
 {
-  struct curl_slist *n;
   char *urle = curl_easy_escape(NULL, path, 0);
   if(urle) {
-    n = curl_slist_append(o->append_path, urle);
-    if(n) {
-      o->append_path = n;
-    }
+    listadd(list, urle);
     curl_free(urle);
   }
 }
@@ -498,64 +861,35 @@ static char *encodeassign(const char *query)
   return urle;
 }
 
-static void queryadd(struct option *o, const char *query)
+static void queryadd(struct curl_slist **list, const char *query)
 {
   char *urle = encodeassign(query);
   if(urle) {
-    struct curl_slist *n = curl_slist_append(o->append_query, urle);
-    if(n)
-      o->append_query = n;
+    listadd(list, urle);
     curl_free(urle);
   }
 }
 
 static void appendadd(struct option *o,
+                      struct curl_slist **paths,
+                      struct curl_slist **queries,
                       const char *arg)
 {
   if(!strncmp("path=", arg, 5))
-    pathadd(o, arg + 5);
+    pathadd(paths, arg + 5);
   else if(!strncmp("query=", arg, 6))
-    queryadd(o, arg + 6);
+    queryadd(queries, arg + 6);
   else
     errorf(o, ERROR_APPEND, "--append unsupported component: %s", arg);
 }
 
-static void setadd(struct option *o,
-                   const char *set) /* [component]=[data] */
-{
-  struct curl_slist *n;
-  n = curl_slist_append(o->set_list, set);
-  if(n)
-    o->set_list = n;
-}
-
-static void iteradd(struct option *o,
-                    const char *iter) /* [component]=[data] */
-{
-  struct curl_slist *n;
-  n = curl_slist_append(o->iter_list, iter);
-  if(n)
-    o->iter_list = n;
-}
-
-static void trimadd(struct option *o,
-                    const char *trim) /* [component]=[data] */
-{
-  struct curl_slist *n;
-  n = curl_slist_append(o->trim_list, trim);
-  if(n)
-    o->trim_list = n;
-}
-
-static void replaceadd(struct option *o,
+static void replaceadd(struct option *o, struct curl_slist **list,
                        const char *replace_list) /* [component]=[data] */
 {
   if(replace_list) {
     char *urle = encodeassign(replace_list);
     if(urle) {
-      struct curl_slist *n = curl_slist_append(o->replace_list, urle);
-      if(n)
-        o->replace_list = n;
+      listadd(list, urle);
       curl_free(urle);
     }
   }
@@ -624,24 +958,150 @@ static int getarg(struct option *o,
   }
   else if(checkoptarg(o, "-a", flag, arg) ||
           checkoptarg(o, "--append", flag, arg)) {
-    appendadd(o, arg);
+    appendadd(o, &o->append_path, &o->append_query, arg);
     *usedarg = gap;
   }
   else if(checkoptarg(o, "-s", flag, arg) ||
           checkoptarg(o, "--set", flag, arg)) {
-    setadd(o, arg);
+    listadd(&o->set_list, arg);
     *usedarg = gap;
   }
   else if(checkoptarg(o, "--iterate", flag, arg)) {
-    iteradd(o, arg);
+    listadd(&o->iter_list, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--base", flag, arg)) {
+    if(o->base)
+      errorf(o, ERROR_FLAG, "only one --base is supported");
+    o->base = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "-o", flag, arg) ||
+          checkoptarg(o, "--output", flag, arg)) {
+    if(o->output)
+      errorf(o, ERROR_FLAG, "only one --output is supported");
+    o->output = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--coprocess", flag, arg)) {
+    if(!strcmp(arg, "line"))
+      o->coprocess = COPROCESS_LINE;
+    else if(!strcmp(arg, "length"))
+      o->coprocess = COPROCESS_LENGTH;
+    else
+      errorf(o, ERROR_FLAG, "unsupported --coprocess framing: %s", arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--serve", flag, arg)) {
+    o->serve = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--input-format", flag, arg)) {
+    if(o->input)
+      errorf(o, ERROR_FLAG, "only one --input-format is supported");
+    if(!strcmp(arg, "tsv"))
+      o->input = INPUT_TSV;
+    else if(!strcmp(arg, "csv"))
+      o->input = INPUT_CSV;
+    else if(!strcmp(arg, "combined"))
+      o->input = INPUT_COMBINED;
+    else if(!strcmp(arg, "nginx-json"))
+      o->input = INPUT_NGINX;
+    else if(!strcmp(arg, "w3c"))
+      o->input = INPUT_W3C;
+    else if(!strcmp(arg, "warc"))
+      o->input = INPUT_WARC;
+    else if(!strcmp(arg, "pcap"))
+      o->input = INPUT_PCAP;
+    else
+      errorf(o, ERROR_FLAG, "unsupported --input-format: %s", arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--input-json-field", flag, arg)) {
+    if(o->input)
+      errorf(o, ERROR_FLAG, "only one --input-format is supported");
+    o->input = INPUT_JSON;
+    o->json_field = arg;
+    *usedarg = gap;
+  }
+  else if(!strcmp("--input-json-rewrite", flag))
+    o->json_rewrite = true;
+  else if(checkoptarg(o, "--url-column", flag, arg)) {
+    char *end;
+    unsigned long col = strtoul(arg, &end, 10);
+    if(*end || !col || (col > MAX_FIELDS))
+      errorf(o, ERROR_FLAG, "bad --url-column: %s", arg);
+    o->url_column = (size_t)col;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--html", flag, arg)) {
+    urlfile(o, arg);
+    o->html = true;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--input-range", flag, arg)) {
+    char *end;
+    if(o->ranged)
+      errorf(o, ERROR_FLAG, "only one --input-range or --part is supported");
+    o->range_start = strtoull(arg, &end, 10);
+    if(!ISDIGIT(*arg) || (*end != ':'))
+      errorf(o, ERROR_FLAG, "bad --input-range: %s", arg);
+    if(end[1]) {
+      const char *e = &end[1];
+      o->range_end = strtoull(e, &end, 10);
+      if(!ISDIGIT(*e) || *end || (o->range_end <= o->range_start))
+        errorf(o, ERROR_FLAG, "bad --input-range: %s", arg);
+    }
+    o->ranged = true;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--part", flag, arg)) {
+    char *end;
+    if(o->ranged)
+      errorf(o, ERROR_FLAG, "only one --input-range or --part is supported");
+    o->part = strtoul(arg, &end, 10);
+    if(!ISDIGIT(*arg) || (*end != '/') || !ISDIGIT(end[1]))
+      errorf(o, ERROR_FLAG, "bad --part: %s", arg);
+    o->parts = strtoul(&end[1], &end, 10);
+    if(*end || !o->part || (o->part > o->parts))
+      errorf(o, ERROR_FLAG, "bad --part: %s", arg);
+    o->ranged = true;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--checkpoint", flag, arg)) {
+    if(o->checkpoint)
+      errorf(o, ERROR_FLAG, "only one --checkpoint is supported");
+    o->checkpoint = arg;
     *usedarg = gap;
   }
+  else if(!strcmp("--resume", flag))
+    o->resume = true;
+  else if(!strcmp("--follow", flag))
+    o->follow = true;
+  else if(!strcmp("--io-uring", flag))
+    o->io_uring = true;
+  else if(!strcmp("--pipeline", flag))
+    o->pipeline = true;
+  else if(!strcmp("--keep-file-order", flag))
+    o->keep_file_order = true;
+  else if(!strcmp("--extract", flag))
+    o->extract = true;
+  else if(!strcmp("-z", flag) || !strcmp("--null", flag))
+    o->delim = 0;
+  else if(!strcmp("--output-thread", flag))
+    o->output_thread = true;
   else if(checkoptarg(o, "--redirect", flag, arg)) {
     if(o->redirect)
       errorf(o, ERROR_FLAG, "only one --redirect is supported");
     o->redirect = arg;
     *usedarg = gap;
   }
+  else if(checkoptarg(o, "--rules", flag, arg)) {
+    if(o->rules)
+      errorf(o, ERROR_FLAG, "only one --rules is supported");
+    rulesload(o, arg);
+    *usedarg = gap;
+  }
   else if(checkoptarg(o, "--query-separator", flag, arg)) {
     if(o->qsep)
       errorf(o, ERROR_FLAG, "only one --query-separator is supported");
@@ -655,11 +1115,11 @@ static int getarg(struct option *o,
     if(strncmp(arg, "query=", 6))
       errorf(o, ERROR_TRIM, "Unsupported trim component: %s", arg);
 
-    trimadd(o, &arg[6]);
+    listadd(&o->trim_list, &arg[6]);
     *usedarg = gap;
   }
   else if(checkoptarg(o, "--qtrim", flag, arg)) {
-    trimadd(o, arg);
+    listadd(&o->trim_list, arg);
     *usedarg = gap;
   }
   else if(checkoptarg(o, "-g", flag, arg) ||
@@ -712,12 +1172,12 @@ static int getarg(struct option *o,
   else if(!strcmp("--quiet", flag))
     o->quiet_warnings = true;
   else if(!strcmp("--replace", flag)) {
-    replaceadd(o, arg);
+    replaceadd(o, &o->replace_list, arg);
     *usedarg = gap;
   }
   else if(!strcmp("--replace-append", flag) ||
           !strcmp("--force-replace", flag)) { /* the initial name */
-    replaceadd(o, arg);
+    replaceadd(o, &o->replace_list, arg);
     o->force_replace = true;
     *usedarg = gap;
   }
@@ -726,14 +1186,14 @@ static int getarg(struct option *o,
   return 0;
 }
 
-static void showqkey(FILE *stream, const char *key, size_t klen,
-                     bool urldecode, bool showall)
+static void showqkey(struct option *o, FILE *stream, const char *key,
+                     size_t klen, bool urldecode, bool showall)
 {
   int i;
   bool shown = false;
-  struct string *qp = urldecode ? qpairsdec : qpairs;
+  struct string *qp = urldecode ? o->qpairsdec : o->qpairs;
 
-  for(i = 0; i< nqpairs; i++) {
+  for(i = 0; i< o->nqpairs; i++) {
     if(!strncmp(key, qp[i].str, klen) && (qp[i].str[klen] == '=')) {
       if(shown)
         fputc(' ', stream);
@@ -757,142 +1217,729 @@ static const struct var *comp2var(const char *name, size_t vlen)
   return NULL;
 }
 
-static CURLUcode geturlpart(struct option *o, int modifiers, CURLU *uh,
-                            CURLUPart part, char **out)
-{
-  CURLUcode rc =
-    curl_url_get(uh, part, out,
-                 (((modifiers & VARMODIFIER_DEFAULT) ||
-                   o->default_port) ?
-                  CURLU_DEFAULT_PORT :
-                  ((part != CURLUPART_URL || o->keep_port) ?
-                   0 : CURLU_NO_DEFAULT_PORT))|
-#ifdef SUPPORTS_PUNYCODE
-                 (((modifiers & VARMODIFIER_PUNY) || o->punycode) ?
-                  CURLU_PUNYCODE : 0)|
-#endif
-#ifdef SUPPORTS_PUNY2IDN
-                 (((modifiers & VARMODIFIER_PUNY2IDN) || o->puny2idn) ?
-                  CURLU_PUNY2IDN : 0) |
-#endif
-#ifdef SUPPORTS_GET_EMPTY
-                 ((modifiers & VARMODIFIER_EMPTY) ? CURLU_GET_EMPTY : 0) |
-#endif
-                 (o->curl ? 0 : CURLU_NON_SUPPORT_SCHEME)|
-                 (((modifiers & VARMODIFIER_URLENCODED) ||
-                   o->urlencode) ?
-                  0 :CURLU_URLDECODE));
-
-#ifdef SUPPORTS_PUNY2IDN
-  /* retry get w/ out puny2idn to handle invalid punycode conversions */
-  if(rc == CURLUE_BAD_HOSTNAME &&
-     (o->puny2idn || (modifiers & VARMODIFIER_PUNY2IDN))) {
-    curl_free(*out);
-    modifiers &= ~VARMODIFIER_PUNY2IDN;
-    o->puny2idn = false;
-    trurl_warnf(o,
-                "Error converting url to IDN [%s]",
-                curl_url_strerror(rc));
-    return geturlpart(o, modifiers, uh, part, out);
-  }
-#endif
-  return rc;
-}
-
-static bool is_valid_trurl_error(CURLUcode rc)
-{
-  switch(rc) {
-    case CURLUE_OK:
-    case CURLUE_NO_SCHEME:
-    case CURLUE_NO_USER:
-    case CURLUE_NO_PASSWORD:
-    case CURLUE_NO_OPTIONS:
-    case CURLUE_NO_HOST:
-    case CURLUE_NO_PORT:
-    case CURLUE_NO_QUERY:
-    case CURLUE_NO_FRAGMENT:
-#ifdef SUPPORTS_ZONEID
-    case CURLUE_NO_ZONEID:
-#endif
-    /* silently ignore */
-      return false;
-    default:
-      return true;
-    }
-  return true;
-}
-
-static void showurl(FILE *stream, struct option *o, int modifiers,
-                    CURLU *uh)
-{
-  char *url;
-  CURLUcode rc = geturlpart(o, modifiers, uh, CURLUPART_URL, &url);
-  if(rc) {
-    trurl_cleanup_options(o);
-    verify(o, ERROR_BADURL, "invalid url [%s]", curl_url_strerror(rc));
-    return;
-  }
-  fputs(url, stream);
-  curl_free(url);
-}
+#define ALLPARTS 0xffffffff
+#define NEEDPART(o,p) ((o)->outparts & (1 << (p)))
 
-static void get(struct option *o, CURLU *uh)
+/* figure out which components the output can show, so that the processing
+   of the other ones can be skipped for every URL */
+static unsigned int outputparts(struct option *o)
 {
-  FILE *stream = stdout;
   const char *ptr = o->format;
-  bool done = false;
+  unsigned int mask = 0;
   char startbyte = 0;
   char endbyte = 0;
 
-  while(ptr && *ptr && !done) {
+  if(!ptr || o->jsonout)
+    /* the full URL is shown */
+    return ALLPARTS;
+
+  while(*ptr) {
     if(!startbyte && (('{' == *ptr) || ('[' == *ptr))) {
       startbyte = *ptr;
-      if('{' == *ptr)
-        endbyte = '}';
-      else
-        endbyte = ']';
+      endbyte = ('{' == *ptr) ? '}' : ']';
     }
     if(startbyte == *ptr) {
-      if(startbyte == ptr[1]) {
+      if(startbyte == ptr[1])
         /* an escaped {-letter */
-        fputc(startbyte, stream);
         ptr += 2;
-      }
       else {
-        /* this is meant as a variable to output */
-        const char *start = ptr;
-        char *end;
-        char *cl;
-        size_t vlen;
-        bool isquery = false;
-        bool queryall = false;
-        bool strict = false; /* strict mode, fail on URL decode problems */
-        bool must = false; /* must mode, fail on missing component */
-        int mods = 0;
-        end = strchr(ptr, endbyte);
-        ptr++; /* pass the { */
-        if(!end) {
-          /* syntax error */
-          fputc(startbyte, stream);
-          continue;
+        const char *name = &ptr[1];
+        const char *end = strchr(name, endbyte);
+        const char *cl;
+        if(!end)
+          break;
+        /* skip the modifiers */
+        while((cl = memchr(name, ':', end - name))) {
+          if(!strncmp(name, "query:", 6) || !strncmp(name, "query-all:", 10)) {
+            mask |= 1 << CURLUPART_QUERY;
+            name = end;
+            break;
+          }
+          if(!strncmp(name, "log:", 4)) {
+            /* not from the URL */
+            name = end;
+            break;
+          }
+          name = cl + 1;
         }
-
-        /* {path} {:path} {/path} */
-        if(*ptr == ':') {
-          mods |= VARMODIFIER_URLENCODED;
-          ptr++;
+        if(name < end) {
+          const struct var *v = comp2var(name, end - name);
+          if(!v)
+            /* the url or a syntax error */
+            return ALLPARTS;
+          mask |= 1 << v->part;
         }
-        vlen = end - ptr;
-        do {
-          size_t wordlen;
-          cl = memchr(ptr, ':', vlen);
-          if(!cl)
-            break;
-          wordlen = cl - ptr + 1;
-
-          /* modifiers! */
-          if(!strncmp(ptr, "default:", wordlen))
-            mods |= VARMODIFIER_DEFAULT;
+        ptr = end + 1;
+      }
+    }
+    else if(('\\' == *ptr) && ptr[1])
+      ptr += 2;
+    else
+      ptr++;
+  }
+  return mask;
+}
+
+/*
+ * Built-in punycode (RFC 3492) conversion of hostnames, without going through
+ * libcurl. Done label by label on spans of the hostname, into caller provided
+ * buffers. Labels that are plain ASCII are left untouched when encoding and
+ * labels without the ACE prefix are left untouched when decoding. Only common
+ * mappings are done, and labels with code points that are never allowed in
+ * hostnames fail to convert.
+ */
+#define PUNY_BASE 36
+#define PUNY_TMIN 1
+#define PUNY_TMAX 26
+#define PUNY_SKEW 38
+#define PUNY_DAMP 700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N 0x80
+#define PUNY_MAXLABEL 256 /* max code points in a single label */
+#define PUNY_ACE "xn--"
+#define PUNY_ACELEN 4
+#define MAX_IDNHOST 2048 /* max length of a converted hostname */
+
+static uint32_t puny_adapt(uint32_t delta, uint32_t numpoints, bool first)
+{
+  uint32_t k = 0;
+  delta = first ? delta / PUNY_DAMP : delta / 2;
+  delta += delta / numpoints;
+  while(delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2) {
+    delta /= PUNY_BASE - PUNY_TMIN;
+    k += PUNY_BASE;
+  }
+  return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+/* the threshold for digit position 'k' */
+static uint32_t puny_threshold(uint32_t k, uint32_t bias)
+{
+  if(k <= bias)
+    return PUNY_TMIN;
+  if(k >= bias + PUNY_TMAX)
+    return PUNY_TMAX;
+  return k - bias;
+}
+
+static char puny_digit(uint32_t d)
+{
+  return (char)(d < 26 ? 'a' + d : '0' + d - 26);
+}
+
+/* returns the value of the digit, PUNY_BASE for an illegal one */
+static uint32_t puny_value(char c)
+{
+  if(ISDIGIT(c))
+    return (uint32_t)(c - '0' + 26);
+  if(ISLOWER(c))
+    return (uint32_t)(c - 'a');
+  if(ISUPPER(c))
+    return (uint32_t)(c - 'A');
+  return PUNY_BASE;
+}
+
+/* decode a single UTF-8 sequence, returns number of bytes used or zero on
+   illegal input */
+static size_t utf8_decode(const unsigned char *s, size_t len, uint32_t *cp)
+{
+  size_t need;
+  size_t i;
+  uint32_t c = s[0];
+  if(c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  else if((c & 0xe0) == 0xc0) {
+    need = 2;
+    c &= 0x1f;
+  }
+  else if((c & 0xf0) == 0xe0) {
+    need = 3;
+    c &= 0x0f;
+  }
+  else if((c & 0xf8) == 0xf0) {
+    need = 4;
+    c &= 0x07;
+  }
+  else
+    return 0;
+  if(len < need)
+    return 0;
+  for(i = 1; i < need; i++) {
+    if((s[i] & 0xc0) != 0x80)
+      return 0;
+    c = (c << 6) | (s[i] & 0x3f);
+  }
+  /* reject overlong forms, surrogates and out of range */
+  if((need == 2 && c < 0x80) || (need == 3 && c < 0x800) ||
+     (need == 4 && c < 0x10000) || (c > 0x10ffff) ||
+     (c >= 0xd800 && c <= 0xdfff))
+    return 0;
+  *cp = c;
+  return need;
+}
+
+/* encode a code point as UTF-8, returns number of bytes or zero if it does
+   not fit */
+static size_t utf8_encode(uint32_t c, char *out, size_t left)
+{
+  if(c < 0x80) {
+    if(left < 1)
+      return 0;
+    out[0] = (char)c;
+    return 1;
+  }
+  else if(c < 0x800) {
+    if(left < 2)
+      return 0;
+    out[0] = (char)(0xc0 | (c >> 6));
+    out[1] = (char)(0x80 | (c & 0x3f));
+    return 2;
+  }
+  else if(c < 0x10000) {
+    if(left < 3)
+      return 0;
+    out[0] = (char)(0xe0 | (c >> 12));
+    out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+    out[2] = (char)(0x80 | (c & 0x3f));
+    return 3;
+  }
+  if(left < 4)
+    return 0;
+  out[0] = (char)(0xf0 | (c >> 18));
+  out[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+  out[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+  out[3] = (char)(0x80 | (c & 0x3f));
+  return 4;
+}
+
+/* map the most common letters as IDNA does: fullwidth ASCII to ASCII and
+   uppercase Latin-1, Latin Extended-A, Greek and Cyrillic to lowercase. This
+   is not a full IDNA mapping. */
+static uint32_t idn_map(uint32_t c)
+{
+  if(((c >= 0xff10) && (c <= 0xff19)) || ((c >= 0xff41) && (c <= 0xff5a)) ||
+     (c == 0xff0d))
+    return c - 0xfee0;
+  if((c >= 0xff21) && (c <= 0xff3a))
+    return c - 0xfee0 + 0x20;
+  if(((c >= 0xc0) && (c <= 0xde) && (c != 0xd7)) ||
+     ((c >= 0x391) && (c <= 0x3ab) && (c != 0x3a2)) ||
+     ((c >= 0x410) && (c <= 0x42f)))
+    return c + 0x20;
+  if((c >= 0x400) && (c <= 0x40f))
+    return c + 0x50;
+  if((c >= 0x100) && (c <= 0x17f)) {
+    /* pairs, uppercase first, with a shift in the middle */
+    if(((c < 0x138) && !(c & 1) && (c != 0x130)) ||
+       ((c > 0x138) && (c < 0x149) && (c & 1)) ||
+       ((c > 0x149) && (c < 0x178) && !(c & 1)) ||
+       ((c > 0x178) && (c < 0x17f) && (c & 1)))
+      return c + 1;
+    if(c == 0x178)
+      return 0xff;
+  }
+  return c;
+}
+
+/* is this non-ASCII code point never allowed in a hostname? Controls,
+   spaces, invisible formatting, private use and noncharacters. */
+static bool idn_disallowed(uint32_t c)
+{
+  return (c < 0xa1) || (c == 0xad) ||
+    ((c >= 0x2000) && (c <= 0x200f)) || ((c >= 0x2028) && (c <= 0x202f)) ||
+    ((c >= 0x205f) && (c <= 0x206f)) || (c == 0x3000) ||
+    ((c >= 0xe000) && (c <= 0xf8ff)) || ((c >= 0xfdd0) && (c <= 0xfdef)) ||
+    (c == 0xfeff) || ((c >= 0xff01) && (c <= 0xff5e)) ||
+    ((c >= 0xfff0) && (c <= 0xfffb)) || ((c & 0xfffe) == 0xfffe) ||
+    (c >= 0xf0000);
+}
+
+/* encode a UTF-8 label into its ACE form. Returns false on failure. */
+static bool puny_encode(const char *in, size_t inlen,
+                        char *out, size_t outsize, size_t *outlen)
+{
+  uint32_t cp[PUNY_MAXLABEL];
+  size_t ncp = 0;
+  size_t i;
+  size_t o = PUNY_ACELEN;
+  uint32_t n = PUNY_INITIAL_N;
+  uint32_t delta = 0;
+  uint32_t bias = PUNY_INITIAL_BIAS;
+  uint32_t h;
+  uint32_t b;
+  bool ace = false;
+
+  while(inlen) {
+    size_t used;
+    if(ncp == PUNY_MAXLABEL)
+      return false;
+    used = utf8_decode((const unsigned char *)in, inlen, &cp[ncp]);
+    if(!used)
+      return false;
+    cp[ncp] = idn_map(cp[ncp]);
+    if(cp[ncp] >= 0x80) {
+      if(idn_disallowed(cp[ncp]))
+        return false;
+      ace = true;
+    }
+    in += used;
+    inlen -= used;
+    ncp++;
+  }
+
+  if(!ace) {
+    /* it maps to plain ASCII */
+    if(ncp > outsize)
+      return false;
+    for(i = 0; i < ncp; i++)
+      out[i] = ISUPPER(cp[i]) ? (char)(cp[i] | ('a' - 'A')) : (char)cp[i];
+    *outlen = ncp;
+    return true;
+  }
+  if(outsize < PUNY_ACELEN)
+    return false;
+  memcpy(out, PUNY_ACE, PUNY_ACELEN);
+
+  /* the basic code points go first, lowercased */
+  for(i = 0; i < ncp; i++) {
+    if(cp[i] < 0x80) {
+      char c = (char)cp[i];
+      if(o >= outsize)
+        return false;
+      out[o++] = ISUPPER(c) ? (char)(c | ('a' - 'A')) : c;
+    }
+  }
+  h = b = (uint32_t)(o - PUNY_ACELEN);
+  if(b) {
+    if(o >= outsize)
+      return false;
+    out[o++] = '-';
+  }
+
+  while(h < ncp) {
+    uint32_t m = UINT32_MAX;
+    for(i = 0; i < ncp; i++)
+      if(cp[i] >= n && cp[i] < m)
+        m = cp[i];
+    if((m - n) > (UINT32_MAX - delta) / (h + 1))
+      return false; /* overflow */
+    delta += (m - n) * (h + 1);
+    n = m;
+    for(i = 0; i < ncp; i++) {
+      if(cp[i] < n) {
+        if(++delta == 0)
+          return false; /* overflow */
+      }
+      if(cp[i] == n) {
+        uint32_t q = delta;
+        uint32_t k;
+        for(k = PUNY_BASE;; k += PUNY_BASE) {
+          uint32_t t = puny_threshold(k, bias);
+          if(q < t)
+            break;
+          if(o >= outsize)
+            return false;
+          out[o++] = puny_digit(t + (q - t) % (PUNY_BASE - t));
+          q = (q - t) / (PUNY_BASE - t);
+        }
+        if(o >= outsize)
+          return false;
+        out[o++] = puny_digit(q);
+        bias = puny_adapt(delta, h + 1, h == b);
+        delta = 0;
+        h++;
+      }
+    }
+    delta++;
+    n++;
+  }
+  *outlen = o;
+  return true;
+}
+
+/* decode an ACE label (without its prefix) into UTF-8. Returns false on
+   failure, which includes labels that only decode into plain ASCII, into
+   code points not allowed in hostnames or into something that does not
+   encode back into the same label. */
+static bool puny_decode(const char *in, size_t inlen,
+                        char *out, size_t outsize, size_t *outlen)
+{
+  uint32_t cp[PUNY_MAXLABEL];
+  uint32_t ncp = 0;
+  uint32_t n = PUNY_INITIAL_N;
+  uint32_t i = 0;
+  uint32_t bias = PUNY_INITIAL_BIAS;
+  size_t b = 0;
+  size_t pos;
+  size_t o = 0;
+  bool nonascii = false;
+  char check[MAX_IDNHOST];
+  size_t checklen;
+
+  /* find the last delimiter */
+  for(pos = 0; pos < inlen; pos++)
+    if(in[pos] == '-')
+      b = pos;
+  if(b > PUNY_MAXLABEL)
+    return false;
+  for(pos = 0; pos < b; pos++) {
+    if((unsigned char)in[pos] >= 0x80)
+      return false;
+    cp[ncp++] = (unsigned char)in[pos];
+  }
+
+  for(pos = b ? b + 1 : 0; pos < inlen;) {
+    uint32_t oldi = i;
+    uint32_t w = 1;
+    uint32_t k;
+    for(k = PUNY_BASE;; k += PUNY_BASE) {
+      uint32_t digit;
+      uint32_t t;
+      if(pos >= inlen)
+        return false;
+      digit = puny_value(in[pos++]);
+      if(digit >= PUNY_BASE)
+        return false;
+      if(digit > (UINT32_MAX - i) / w)
+        return false; /* overflow */
+      i += digit * w;
+      t = puny_threshold(k, bias);
+      if(digit < t)
+        break;
+      if(w > UINT32_MAX / (PUNY_BASE - t))
+        return false; /* overflow */
+      w *= PUNY_BASE - t;
+    }
+    bias = puny_adapt(i - oldi, ncp + 1, oldi == 0);
+    if(i / (ncp + 1) > UINT32_MAX - n)
+      return false; /* overflow */
+    n += i / (ncp + 1);
+    i %= (ncp + 1);
+    if((ncp == PUNY_MAXLABEL) || (n < 0x80) || (n > 0x10ffff) ||
+       (n >= 0xd800 && n <= 0xdfff) || idn_disallowed(n))
+      return false;
+    memmove(&cp[i + 1], &cp[i], (ncp - i) * sizeof(uint32_t));
+    cp[i++] = n;
+    ncp++;
+  }
+
+  for(i = 0; i < ncp; i++) {
+    size_t used = utf8_encode(cp[i], &out[o], outsize - o);
+    if(!used)
+      return false;
+    if(cp[i] >= 0x80)
+      nonascii = true;
+    o += used;
+  }
+  if(!nonascii)
+    /* a proper A-label never decodes into plain ASCII */
+    return false;
+  if(!puny_encode(out, o, check, sizeof(check), &checklen) ||
+     (checklen != inlen + PUNY_ACELEN) ||
+     casecompare(&check[PUNY_ACELEN], in, inlen))
+    /* not what a proper encoder makes of it */
+    return false;
+  *outlen = o;
+  return true;
+}
+
+/* does this label need conversion? */
+static bool idn_label(const char *label, size_t len, bool toidn)
+{
+  size_t i;
+  if(toidn)
+    return (len > PUNY_ACELEN) && !casecompare(label, PUNY_ACE, PUNY_ACELEN);
+  for(i = 0; i < len; i++)
+    if((unsigned char)label[i] >= 0x80)
+      return true;
+  return false;
+}
+
+/*
+ * Convert the hostname to punycode or to IDN. Returns CURLUE_OK and sets
+ * '*outlen' to zero if no conversion was necessary, in which case nothing is
+ * written to the buffer.
+ */
+static CURLUcode idnconvert(const char *host, bool toidn,
+                            char *buf, size_t bufsize, size_t *outlen)
+{
+  const char *label = host;
+  size_t o = 0;
+  bool convert = false;
+
+  *outlen = 0;
+  if(host[0] == '[')
+    /* IPv6 numerical address */
+    return CURLUE_OK;
+
+  /* fast path: check if any label needs converting */
+  while(*label) {
+    const char *dot = strchr(label, '.');
+    size_t len = dot ? (size_t)(dot - label) : strlen(label);
+    if(idn_label(label, len, toidn)) {
+      convert = true;
+      break;
+    }
+    label += len + (dot ? 1 : 0);
+  }
+  if(!convert)
+    return CURLUE_OK;
+
+  for(label = host; *label;) {
+    const char *dot = strchr(label, '.');
+    size_t len = dot ? (size_t)(dot - label) : strlen(label);
+    if(idn_label(label, len, toidn)) {
+      size_t used;
+      bool ok = toidn ?
+        puny_decode(&label[PUNY_ACELEN], len - PUNY_ACELEN,
+                    &buf[o], bufsize - o, &used) :
+        puny_encode(label, len, &buf[o], bufsize - o, &used);
+      if(!ok)
+        return CURLUE_BAD_HOSTNAME;
+      o += used;
+    }
+    else {
+      if(len >= bufsize - o)
+        return CURLUE_BAD_HOSTNAME;
+      memcpy(&buf[o], label, len);
+      o += len;
+    }
+    if(dot) {
+      if(o >= bufsize - 1)
+        return CURLUE_BAD_HOSTNAME;
+      buf[o++] = '.';
+      len++;
+    }
+    label += len;
+  }
+  buf[o] = 0;
+  *outlen = o;
+  return CURLUE_OK;
+}
+
+static unsigned int getflags(struct option *o, int modifiers,
+                             CURLUPart part)
+{
+  return (((modifiers & VARMODIFIER_DEFAULT) ||
+           o->default_port) ?
+          CURLU_DEFAULT_PORT :
+          ((part != CURLUPART_URL || o->keep_port) ?
+           0 : CURLU_NO_DEFAULT_PORT))|
+#ifdef SUPPORTS_GET_EMPTY
+    ((modifiers & VARMODIFIER_EMPTY) ? CURLU_GET_EMPTY : 0) |
+#endif
+    (o->curl ? 0 : CURLU_NON_SUPPORT_SCHEME)|
+    (((modifiers & VARMODIFIER_URLENCODED) ||
+      o->urlencode) ?
+     0 :CURLU_URLDECODE);
+}
+
+/* get the URL or the host with the hostname converted to punycode/IDN */
+static CURLUcode getidnpart(struct option *o, int modifiers, CURLU *uh,
+                            CURLUPart part, bool toidn, char **out)
+{
+  char buf[MAX_IDNHOST];
+  size_t blen;
+  char *host;
+  CURLUcode rc = curl_url_get(uh, CURLUPART_HOST, &host, 0);
+  if(rc)
+    /* no host to convert */
+    return curl_url_get(uh, part, out, getflags(o, modifiers, part));
+
+  rc = idnconvert(host, toidn, buf, sizeof(buf), &blen);
+  curl_free(host);
+  if(rc) {
+    *out = NULL;
+    return rc;
+  }
+  if(!blen)
+    /* nothing to convert */
+    return curl_url_get(uh, part, out, getflags(o, modifiers, part));
+
+  if(part == CURLUPART_HOST) {
+    *out = curl_maprintf("%s", buf);
+    return *out ? CURLUE_OK : CURLUE_OUT_OF_MEMORY;
+  }
+  else {
+    CURLU *dup = curl_url_dup(uh);
+    if(!dup)
+      return CURLUE_OUT_OF_MEMORY;
+    rc = curl_url_set(dup, CURLUPART_HOST, buf, 0);
+    if(!rc)
+      rc = curl_url_get(dup, part, out, getflags(o, modifiers, part));
+    curl_url_cleanup(dup);
+  }
+  return rc;
+}
+
+static CURLUcode geturlpart(struct option *o, int modifiers, CURLU *uh,
+                            CURLUPart part, char **out)
+{
+  CURLUcode rc;
+  bool puny = (modifiers & VARMODIFIER_PUNY) || o->punycode;
+  bool toidn = (modifiers & VARMODIFIER_PUNY2IDN) || o->puny2idn;
+
+  if((puny || toidn) &&
+     ((part == CURLUPART_URL) || (part == CURLUPART_HOST))) {
+    rc = getidnpart(o, modifiers, uh, part, toidn, out);
+  }
+  else
+    rc = curl_url_get(uh, part, out, getflags(o, modifiers, part));
+
+  /* retry get w/ out puny2idn to handle invalid punycode conversions */
+  if(rc == CURLUE_BAD_HOSTNAME && toidn) {
+    curl_free(*out);
+    modifiers &= ~VARMODIFIER_PUNY2IDN;
+    o->puny2idn = false;
+    trurl_warnf(o,
+                "Error converting url to IDN [%s]",
+                curl_url_strerror(rc));
+    return geturlpart(o, modifiers, uh, part, out);
+  }
+  return rc;
+}
+
+static bool is_valid_trurl_error(CURLUcode rc)
+{
+  switch(rc) {
+    case CURLUE_OK:
+    case CURLUE_NO_SCHEME:
+    case CURLUE_NO_USER:
+    case CURLUE_NO_PASSWORD:
+    case CURLUE_NO_OPTIONS:
+    case CURLUE_NO_HOST:
+    case CURLUE_NO_PORT:
+    case CURLUE_NO_QUERY:
+    case CURLUE_NO_FRAGMENT:
+#ifdef SUPPORTS_ZONEID
+    case CURLUE_NO_ZONEID:
+#endif
+    /* silently ignore */
+      return false;
+    default:
+      return true;
+    }
+  return true;
+}
+
+static void showurl(FILE *stream, struct option *o, int modifiers,
+                    CURLU *uh)
+{
+  char *url;
+  CURLUcode rc = geturlpart(o, modifiers, uh, CURLUPART_URL, &url);
+  if(rc) {
+    verify(o, ERROR_BADURL, "invalid url [%s]", curl_url_strerror(rc));
+    return;
+  }
+  fputs(url, stream);
+  curl_free(url);
+}
+
+/* a stream for a --get value that becomes a CSV field */
+static FILE *cellopen(struct option *o)
+{
+  struct row *r = o->row;
+#ifdef _MSC_VER
+  /* no open_memstream() */
+  r->cell = tmpfile();
+#else
+  r->cell = open_memstream(&r->cellbuf, &r->cellsize);
+#endif
+  if(!r->cell)
+    errorf(o, ERROR_MEM, "out of memory");
+  return r->cell;
+}
+
+/* close the cellopen() stream, what was written to it is in r->cellbuf */
+static void cellclose(struct option *o)
+{
+  struct row *r = o->row;
+  FILE *cell = r->cell;
+  bool ok;
+#ifdef _MSC_VER
+  long len = ftell(cell);
+  ok = false;
+  if(len >= 0) {
+    r->cellbuf = malloc((size_t)len + 1);
+    rewind(cell);
+    if(r->cellbuf &&
+       (fread(r->cellbuf, 1, (size_t)len, cell) == (size_t)len)) {
+      r->cellbuf[len] = 0;
+      ok = true;
+    }
+  }
+  ok = !fclose(cell) && ok;
+#else
+  ok = !fclose(cell);
+#endif
+  r->cell = NULL;
+  if(!ok)
+    errorf(o, ERROR_MEM, "out of memory");
+}
+
+static void get(struct option *o, CURLU *uh)
+{
+  FILE *stream = o->out;
+  const char *ptr = o->format;
+  bool done = false;
+  char startbyte = 0;
+  char endbyte = 0;
+
+  while(ptr && *ptr && !done) {
+    if(!startbyte && (('{' == *ptr) || ('[' == *ptr))) {
+      startbyte = *ptr;
+      if('{' == *ptr)
+        endbyte = '}';
+      else
+        endbyte = ']';
+    }
+    if(startbyte == *ptr) {
+      if(startbyte == ptr[1]) {
+        /* an escaped {-letter */
+        fputc(startbyte, stream);
+        ptr += 2;
+      }
+      else {
+        /* this is meant as a variable to output */
+        const char *start = ptr;
+        char *end;
+        char *cl;
+        size_t vlen;
+        bool isquery = false;
+        bool queryall = false;
+        bool islog = false;
+        bool strict = false; /* strict mode, fail on URL decode problems */
+        bool must = false; /* must mode, fail on missing component */
+        int mods = 0;
+        end = strchr(ptr, endbyte);
+        ptr++; /* pass the { */
+        if(!end) {
+          /* syntax error */
+          fputc(startbyte, stream);
+          continue;
+        }
+        if(o->row && (o->input == INPUT_CSV))
+          /* the value is quoted as a field if it needs to be */
+          stream = cellopen(o);
+
+        /* {path} {:path} {/path} */
+        if(*ptr == ':') {
+          mods |= VARMODIFIER_URLENCODED;
+          ptr++;
+        }
+        vlen = end - ptr;
+        do {
+          size_t wordlen;
+          cl = memchr(ptr, ':', vlen);
+          if(!cl)
+            break;
+          wordlen = cl - ptr + 1;
+
+          /* modifiers! */
+          if(!strncmp(ptr, "default:", wordlen))
+            mods |= VARMODIFIER_DEFAULT;
           else if(!strncmp(ptr, "puny:", wordlen)) {
             if(mods & VARMODIFIER_PUNY2IDN)
               errorf(o, ERROR_GET,
@@ -920,6 +1967,8 @@ static void get(struct option *o, CURLU *uh)
             }
             else if(!strncmp(ptr, "query:", wordlen))
               isquery = true;
+            else if(!strncmp(ptr, "log:", wordlen))
+              islog = true;
             else {
               /* syntax error */
               vlen = 0;
@@ -933,10 +1982,12 @@ static void get(struct option *o, CURLU *uh)
         } while(true);
 
         if(isquery) {
-          showqkey(stream, cl + 1, end - cl - 1,
+          showqkey(o, stream, cl + 1, end - cl - 1,
                    !o->urlencode && !(mods & VARMODIFIER_URLENCODED),
                    queryall);
         }
+        else if(islog)
+          showlog(o, stream, cl + 1, end - cl - 1);
         else if(!vlen)
           errorf(o, ERROR_GET, "Bad --get syntax: %s", start);
         else if(!strncmp(ptr, "url", vlen))
@@ -981,6 +2032,14 @@ static void get(struct option *o, CURLU *uh)
                    (int)vlen, ptr);
         }
         ptr = end + 1; /* pass the end */
+        if(stream != o->out) {
+          struct row *r = o->row;
+          cellclose(o);
+          stream = o->out;
+          rowvalue(o, r->cellbuf);
+          free(r->cellbuf);
+          r->cellbuf = NULL;
+        }
       }
     }
     else if('\\' == *ptr && ptr[1]) {
@@ -1016,7 +2075,7 @@ static void get(struct option *o, CURLU *uh)
       ptr++;
     }
   }
-  fputc('\n', stream);
+  fputc(o->delim, stream);
 }
 
 static const struct var *setone(CURLU *uh, const char *setline,
@@ -1069,7 +2128,7 @@ static const struct var *setone(CURLU *uh, const char *setline,
                           (o->curl ? 0 : CURLU_NON_SUPPORT_SCHEME)|
                           (urlencode ? CURLU_URLENCODE : 0) );
       if(rc)
-        warnf("Error setting %s: %s", v->name, curl_url_strerror(rc));
+        warnf(o, "Error setting %s: %s", v->name, curl_url_strerror(rc));
       found = true;
     }
     if(!found)
@@ -1081,21 +2140,808 @@ static const struct var *setone(CURLU *uh, const char *setline,
   return v;
 }
 
-static unsigned int set(CURLU *uh,
-                        struct option *o)
+/*
+ * --input-format tsv and csv: each input line is a row, the URL is taken
+ * from the --url-column and the row is written back with that column
+ * replaced, or with the --get output appended. --set values can refer to
+ * the columns of the same row with $N.
+ */
+
+/* split the row into fields */
+static void rowsplit(struct option *o, struct row *r, const char *line,
+                     size_t len)
 {
-  struct curl_slist *node;
-  unsigned int mask = 0;
-  for(node =  o->set_list; node; node = node->next) {
-    const struct var *v;
-    char *setline = node->data;
-    v = setone(uh, setline, o);
-    if(v) {
-      if(mask & (1 << v->part))
-        errorf(o, ERROR_SET,
-                     "duplicate --set for component %s", v->name);
-      mask |= (1 << v->part);
-    }
+  const char *p = line;
+  const char *end = &line[len];
+  char *out;
+
+  if(r->bufsize < (len + MAX_FIELDS + 1)) {
+    free(r->buf);
+    r->bufsize = len + MAX_FIELDS + 1;
+    r->buf = malloc(r->bufsize);
+    if(!r->buf)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+  out = r->buf;
+  r->line = line;
+  r->len = len;
+  r->nfields = 0;
+
+  for(;;) {
+    const char *start = p;
+    r->value[r->nfields] = out;
+    if(r->nfields == (MAX_FIELDS - 1)) {
+      /* the last field gets the rest of the row */
+      memcpy(out, p, end - p);
+      out += end - p;
+      p = end;
+    }
+    else if((o->input == INPUT_CSV) && (p < end) && (*p == '\"')) {
+      /* quoted, "" is a quote within the field */
+      for(p++; p < end; p++) {
+        if(*p == '\"') {
+          if(((p + 1) < end) && (p[1] == '\"'))
+            p++;
+          else {
+            p++;
+            break;
+          }
+        }
+        *out++ = *p;
+      }
+      while((p < end) && (*p != r->sep))
+        *out++ = *p++;
+    }
+    else {
+      while((p < end) && (*p != r->sep))
+        *out++ = *p++;
+    }
+    *out++ = 0;
+    r->raw[r->nfields] = start;
+    r->rawlen[r->nfields] = p - start;
+    r->nfields++;
+    if(p == end)
+      break;
+    p++; /* the separator */
+  }
+
+  if(o->url_column <= r->nfields) {
+    size_t col = o->url_column - 1;
+    r->url = r->value[col];
+    r->prelen = r->raw[col] - line;
+    r->postoff = r->prelen + r->rawlen[col];
+  }
+  else
+    r->url = NULL;
+}
+
+/*
+ * --input-json-field: find the field in the JSON object on the line without
+ * parsing all of it. Strings are skipped with memchr() and values that are
+ * not on the path are skipped by only tracking the nesting.
+ */
+
+static const char *jsonws(const char *p, const char *end)
+{
+  while((p < end) &&
+        ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n')))
+    p++;
+  return p;
+}
+
+/* skip the string starting at the quote, return what follows it */
+static const char *jsonskipstr(const char *p, const char *end)
+{
+  for(p++; p < end;) {
+    const char *q = memchr(p, '\"', end - p);
+    const char *b;
+    if(!q)
+      break;
+    /* an odd number of backslashes before it escapes it */
+    for(b = q; (b > p) && (b[-1] == '\\'); b--)
+      ;
+    if(!((q - b) & 1))
+      return q + 1;
+    p = q + 1;
+  }
+  return NULL;
+}
+
+/* skip any value, return what follows it */
+static const char *jsonskip(const char *p, const char *end)
+{
+  int depth = 0;
+  while(p && (p < end)) {
+    switch(*p) {
+    case '\"':
+      p = jsonskipstr(p, end);
+      if(!depth)
+        return p;
+      continue;
+    case '{':
+    case '[':
+      depth++;
+      break;
+    case '}':
+    case ']':
+      if(!depth)
+        return p;
+      if(!--depth)
+        return p + 1;
+      break;
+    case ',':
+      if(!depth)
+        return p;
+      break;
+    default:
+      break;
+    }
+    p++;
+  }
+  return depth ? NULL : p;
+}
+
+/* find the value of the dot separated field in the object at 'p' */
+static const char *jsonfind(const char *p, const char *end, const char *field)
+{
+  const char *dot = strchr(field, '.');
+  size_t flen = dot ? (size_t)(dot - field) : strlen(field);
+
+  p = jsonws(p, end);
+  if((p == end) || (*p != '{'))
+    return NULL;
+  p++;
+  for(;;) {
+    const char *key;
+    bool match;
+    p = jsonws(p, end);
+    if((p == end) || (*p != '\"'))
+      return NULL;
+    key = p + 1;
+    p = jsonskipstr(p, end);
+    if(!p)
+      return NULL;
+    match = ((size_t)(p - 1 - key) == flen) && !memcmp(key, field, flen);
+    p = jsonws(p, end);
+    if((p == end) || (*p != ':'))
+      return NULL;
+    p = jsonws(p + 1, end);
+    if(match)
+      return dot ? jsonfind(p, end, dot + 1) : p;
+    p = jsonws(jsonskip(p, end), end);
+    if(!p || (p == end) || (*p != ','))
+      return NULL;
+    p++;
+  }
+}
+
+static int jsonhex(const char *p)
+{
+  int i;
+  int v = 0;
+  for(i = 0; i < 4; i++) {
+    char c = p[i];
+    v <<= 4;
+    if(ISDIGIT(c))
+      v |= c - '0';
+    else if((c >= 'a') && (c <= 'f'))
+      v |= c - 'a' + 10;
+    else if((c >= 'A') && (c <= 'F'))
+      v |= c - 'A' + 10;
+    else
+      return -1;
+  }
+  return v;
+}
+
+/* decode the JSON string at 'p' into 'out', return what follows it */
+static const char *jsondecode(const char *p, const char *end, char *out)
+{
+  for(p++; p < end; p++) {
+    if(*p == '\"') {
+      *out = 0;
+      return p + 1;
+    }
+    if(*p != '\\')
+      *out++ = *p;
+    else if(++p == end)
+      break;
+    else {
+      switch(*p) {
+      case 'b':
+        *out++ = '\b';
+        break;
+      case 'f':
+        *out++ = '\f';
+        break;
+      case 'n':
+        *out++ = '\n';
+        break;
+      case 'r':
+        *out++ = '\r';
+        break;
+      case 't':
+        *out++ = '\t';
+        break;
+      case 'u': {
+        int c = ((end - p) < 5) ? -1 : jsonhex(&p[1]);
+        uint32_t cp;
+        if(c < 0)
+          return NULL;
+        p += 4;
+        cp = (uint32_t)c;
+        if((cp >= 0xd800) && (cp < 0xdc00) && ((end - p) >= 7) &&
+           (p[1] == '\\') && (p[2] == 'u')) {
+          c = jsonhex(&p[3]);
+          if((c >= 0xdc00) && (c < 0xe000)) {
+            /* a surrogate pair */
+            cp = 0x10000 + ((cp - 0xd800) << 10) + ((uint32_t)c - 0xdc00);
+            p += 6;
+          }
+        }
+        if(!cp) {
+          /* a zero would end the string, keep it URL encoded */
+          memcpy(out, "%00", 3);
+          out += 3;
+        }
+        else
+          out += utf8_encode(cp, out, 4);
+        break;
+      }
+      default:
+        /* \" \\ \/ */
+        *out++ = *p;
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* find the URL in a JSON object row */
+static void jsonrow(struct option *o, struct row *r, const char *line,
+                    size_t len)
+{
+  const char *end = &line[len];
+  const char *val = jsonfind(line, end, o->json_field);
+  const char *after = NULL;
+
+  if(r->bufsize < (len + 1)) {
+    free(r->buf);
+    r->bufsize = len + 1;
+    r->buf = malloc(r->bufsize);
+    if(!r->buf)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+  r->line = line;
+  r->len = len;
+  r->nfields = 0;
+  r->url = NULL;
+  if(val && (*val == '\"'))
+    after = jsondecode(val, end, r->buf);
+  if(after) {
+    r->url = r->buf;
+    r->prelen = val - line;
+    r->postoff = after - line;
+  }
+}
+
+/* return a copy of 'value' with $N replaced by column N of the row, or NULL
+   if there is nothing to replace */
+static char *rowexpand(struct option *o, const char *value)
+{
+  struct row *r = o->row;
+  const char *p;
+  size_t vlen;
+  char *exp;
+  char *out;
+
+  if(!r || !strchr(value, '$'))
+    return NULL;
+  vlen = strlen(value);
+  /* each reference is at least two bytes and at most the whole row */
+  exp = malloc(vlen + (vlen / 2 + 1) * r->len + 1);
+  if(!exp)
+    errorf(o, ERROR_MEM, "out of memory");
+  out = exp;
+  for(p = value; *p; p++) {
+    if((*p == '$') && ISDIGIT(p[1])) {
+      size_t col = 0;
+      while(ISDIGIT(p[1]) && (col < MAX_FIELDS))
+        col = col * 10 + (size_t)(*++p - '0');
+      if(col && (col <= r->nfields)) {
+        size_t flen = strlen(r->value[col - 1]);
+        memcpy(out, r->value[col - 1], flen);
+        out += flen;
+      }
+    }
+    else if((*p == '$') && (p[1] == '$'))
+      /* $$ is a single dollar sign */
+      *out++ = *p++;
+    else
+      *out++ = *p;
+  }
+  *out = 0;
+  return exp;
+}
+
+/*
+ * --input-format combined, nginx-json and w3c: web server access logs. The
+ * absolute URL is put together from the request target and the host in the
+ * log line, the other fields of the line can be shown with {log:[name]} in
+ * --get.
+ */
+
+/* the fields of a combined log line, in order */
+static const char *const combinedfields[] = {
+  "remote", "ident", "user", "time", "request", "status", "bytes",
+  "referer", "agent", "host",
+  /* the parts of the request */
+  "method", "target", "protocol",
+  NULL
+};
+#define CLF_REQUEST 4
+#define CLF_HOST 9
+#define CLF_METHOD 10
+#define CLF_TARGET 11
+#define CLF_PROTOCOL 12
+
+/* the fields of a request in a packet capture, in order */
+static const char *const pcapfields[] = {
+  "method", "target", "protocol", "host", "client", "server", "time",
+  "request", NULL
+};
+#define PCAP_METHOD 0
+#define PCAP_TARGET 1
+#define PCAP_PROTOCOL 2
+#define PCAP_HOST 3
+#define PCAP_CLIENT 4
+#define PCAP_SERVER 5
+#define PCAP_TIME 6
+#define PCAP_REQUEST 7
+
+/* make room for a URL of 'len' bytes */
+static char *logbuf(struct option *o, struct row *r, size_t len)
+{
+  if(r->ubufsize < (len + 1)) {
+    free(r->ubuf);
+    r->ubufsize = len + 64;
+    r->ubuf = malloc(r->ubufsize);
+    if(!r->ubuf)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+  return r->ubuf;
+}
+
+/* put together the URL for the target, returns false if not possible */
+static bool logurl(struct option *o, struct row *r,
+                   const char *scheme, size_t slen,
+                   const char *host, size_t hlen,
+                   const char *port, size_t plen,
+                   const char *target, size_t tlen,
+                   const char *query, size_t qlen)
+{
+  char *u;
+  if(!tlen)
+    return false;
+  if(target[0] != '/') {
+    /* absolute-form, from a proxy, or asterisk-form */
+    if(!memchr(target, ':', tlen))
+      return false;
+    u = logbuf(o, r, tlen + qlen + 1);
+    memcpy(u, target, tlen);
+    u += tlen;
+  }
+  else if(!hlen) {
+    /* no host in the log line, only possible to resolve with --base */
+    if(!o->base)
+      return false;
+    u = logbuf(o, r, tlen + qlen + 1);
+    memcpy(u, target, tlen);
+    u += tlen;
+  }
+  else {
+    u = logbuf(o, r, slen + hlen + plen + tlen + qlen + 5);
+    memcpy(u, scheme, slen);
+    u += slen;
+    memcpy(u, "://", 3);
+    u += 3;
+    memcpy(u, host, hlen);
+    u += hlen;
+    if(plen) {
+      *u++ = ':';
+      memcpy(u, port, plen);
+      u += plen;
+    }
+    memcpy(u, target, tlen);
+    u += tlen;
+  }
+  if(qlen) {
+    *u++ = '?';
+    memcpy(u, query, qlen);
+    u += qlen;
+  }
+  *u = 0;
+  r->url = r->ubuf;
+  return true;
+}
+
+/* split 'GET /path HTTP/1.1' */
+static void logrequest(struct row *r, size_t req, size_t method,
+                       size_t target, size_t protocol)
+{
+  const char *p = r->raw[req];
+  const char *end = &p[r->rawlen[req]];
+  size_t f[3];
+  size_t i;
+  f[0] = method;
+  f[1] = target;
+  f[2] = protocol;
+  for(i = 0; i < 3; i++) {
+    const char *sp;
+    while((p < end) && (*p == ' '))
+      p++;
+    sp = memchr(p, ' ', end - p);
+    if(!sp || (i == 2))
+      sp = end;
+    r->raw[f[i]] = p;
+    r->rawlen[f[i]] = sp - p;
+    p = sp;
+  }
+}
+
+static void combinedrow(struct option *o, struct row *r)
+{
+  const char *p = r->line;
+  const char *end = &r->line[r->len];
+  size_t i;
+
+  for(i = 0; i < CLF_METHOD; i++) {
+    const char *start;
+    char close = 0;
+    while((p < end) && (*p == ' '))
+      p++;
+    if(p == end)
+      break;
+    if(*p == '\"')
+      close = '\"';
+    else if(*p == '[')
+      close = ']';
+    if(close) {
+      start = ++p;
+      while((p < end) && (*p != close)) {
+        if((*p == '\\') && ((p + 1) < end))
+          p++;
+        p++;
+      }
+    }
+    else {
+      start = p;
+      while((p < end) && (*p != ' '))
+        p++;
+    }
+    r->raw[i] = start;
+    r->rawlen[i] = p - start;
+    if(p < end)
+      p++;
+  }
+  for(; i < CLF_METHOD; i++) {
+    r->raw[i] = end;
+    r->rawlen[i] = 0;
+  }
+  logrequest(r, CLF_REQUEST, CLF_METHOD, CLF_TARGET, CLF_PROTOCOL);
+  if((r->rawlen[CLF_HOST] == 1) && (r->raw[CLF_HOST][0] == '-'))
+    /* no host logged */
+    r->rawlen[CLF_HOST] = 0;
+  logurl(o, r, "http", 4, r->raw[CLF_HOST], r->rawlen[CLF_HOST], NULL, 0,
+         r->raw[CLF_TARGET], r->rawlen[CLF_TARGET], NULL, 0);
+}
+
+/* decode a string field of the nginx JSON log line into 'out' */
+static size_t nginxfield(struct row *r, const char *name, char *out)
+{
+  const char *end = &r->line[r->len];
+  const char *val = jsonfind(r->line, end, name);
+  if(val && (*val == '\"') && jsondecode(val, end, out))
+    return strlen(out);
+  *out = 0;
+  return 0;
+}
+
+static void nginxrow(struct option *o, struct row *r)
+{
+  /* room for the four fields, none longer than the line */
+  size_t size = r->len + 1;
+  char *scheme;
+  char *host;
+  char *target;
+  char *query;
+  size_t slen;
+  size_t hlen;
+  size_t tlen;
+  size_t qlen = 0;
+
+  if(r->bufsize < (4 * size)) {
+    free(r->buf);
+    r->bufsize = 4 * size;
+    r->buf = malloc(r->bufsize);
+    if(!r->buf)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+  scheme = r->buf;
+  host = &r->buf[size];
+  target = &r->buf[2 * size];
+  query = &r->buf[3 * size];
+
+  slen = nginxfield(r, "scheme", scheme);
+  if(!slen) {
+    memcpy(scheme, "http", 5);
+    slen = 4;
+  }
+  hlen = nginxfield(r, "host", host);
+  if(!hlen)
+    hlen = nginxfield(r, "http_host", host);
+  if(!hlen)
+    hlen = nginxfield(r, "server_name", host);
+  tlen = nginxfield(r, "request_uri", target);
+  if(!tlen) {
+    tlen = nginxfield(r, "request", target);
+    if(tlen) {
+      /* the target in the request line */
+      char *t = memchr(target, ' ', tlen);
+      char *e;
+      tlen = 0;
+      if(t) {
+        t++;
+        e = memchr(t, ' ', strlen(t));
+        tlen = e ? (size_t)(e - t) : strlen(t);
+        memmove(target, t, tlen);
+      }
+    }
+    else {
+      tlen = nginxfield(r, "uri", target);
+      qlen = nginxfield(r, "args", query);
+    }
+  }
+  logurl(o, r, scheme, slen, host, hlen, NULL, 0, target, tlen, query, qlen);
+}
+
+/* store the names in a W3C #Fields directive */
+static void w3cfields(struct option *o, struct row *r, const char *line,
+                      size_t len)
+{
+  char *p;
+  free(r->names);
+  r->names = malloc(len + 1);
+  if(!r->names)
+    errorf(o, ERROR_MEM, "out of memory");
+  memcpy(r->names, line, len);
+  r->names[len] = 0;
+  r->nnames = 0;
+  p = r->names;
+  while(*p && (r->nnames < MAX_FIELDS)) {
+    while(*p == ' ')
+      p++;
+    if(!*p)
+      break;
+    r->fieldname[r->nnames++] = p;
+    while(*p && (*p != ' '))
+      p++;
+    if(*p)
+      *p++ = 0;
+  }
+}
+
+/* the span of the named W3C field, returns false if not there or '-' */
+static bool w3cfield(struct row *r, const char *name, const char **ptr,
+                     size_t *len)
+{
+  size_t i;
+  for(i = 0; (i < r->nnames) && (i < r->nraw); i++) {
+    if(!strcmp(r->fieldname[i], name)) {
+      if((r->rawlen[i] == 1) && (r->raw[i][0] == '-'))
+        break;
+      *ptr = r->raw[i];
+      *len = r->rawlen[i];
+      return true;
+    }
+  }
+  *ptr = NULL;
+  *len = 0;
+  return false;
+}
+
+static void w3crow(struct option *o, struct row *r)
+{
+  const char *p = r->line;
+  const char *end = &r->line[r->len];
+  const char *host;
+  const char *port;
+  const char *stem;
+  const char *query;
+  size_t hlen;
+  size_t plen;
+  size_t tlen;
+  size_t qlen;
+  bool https;
+
+  if(*p == '#') {
+    /* a directive */
+    if((r->len > 8) && !strncmp(p, "#Fields:", 8))
+      w3cfields(o, r, p + 8, r->len - 8);
+    r->skip = true;
+    return;
+  }
+  r->nraw = 0;
+  while((p < end) && (r->nraw < MAX_FIELDS)) {
+    const char *sp = memchr(p, ' ', end - p);
+    if(!sp)
+      sp = end;
+    r->raw[r->nraw] = p;
+    r->rawlen[r->nraw++] = sp - p;
+    p = sp + 1;
+  }
+
+  if(!w3cfield(r, "cs-host", &host, &hlen))
+    w3cfield(r, "s-ip", &host, &hlen);
+  w3cfield(r, "s-port", &port, &plen);
+  https = (plen == 3) && !strncmp(port, "443", 3);
+  if(https || ((plen == 2) && !strncmp(port, "80", 2)))
+    /* the default port */
+    plen = 0;
+  w3cfield(r, "cs-uri-stem", &stem, &tlen);
+  w3cfield(r, "cs-uri-query", &query, &qlen);
+  logurl(o, r, https ? "https" : "http", https ? 5 : 4, host, hlen,
+         port, plen, stem, tlen, query, qlen);
+}
+
+/* the value of the named header in the current WARC record, the lines of
+   the header block are in the raw fields */
+static bool warcfield(struct row *r, const char *name, const char **ptr,
+                      size_t *len)
+{
+  size_t nlen = strlen(name);
+  size_t i;
+  for(i = 0; i < r->nraw; i++) {
+    const char *p = r->raw[i];
+    const char *end = &p[r->rawlen[i]];
+    if((r->rawlen[i] > nlen) && (p[nlen] == ':') &&
+       !casecompare(p, name, nlen)) {
+      p += nlen + 1;
+      while((p < end) && ((*p == ' ') || (*p == '\t')))
+        p++;
+      while((end > p) && ((end[-1] == ' ') || (end[-1] == '\t')))
+        end--;
+      *ptr = p;
+      *len = end - p;
+      return true;
+    }
+  }
+  *ptr = NULL;
+  *len = 0;
+  return false;
+}
+
+/* find the URL in an access log line */
+static void logrow(struct option *o, struct row *r, const char *line,
+                   size_t len)
+{
+  r->line = line;
+  r->len = len;
+  r->nfields = 0;
+  r->url = NULL;
+  r->skip = false;
+  switch(o->input) {
+  case INPUT_COMBINED:
+    combinedrow(o, r);
+    break;
+  case INPUT_NGINX:
+    nginxrow(o, r);
+    break;
+  default:
+    w3crow(o, r);
+    break;
+  }
+}
+
+/* output {log:[name]} */
+static void showlog(struct option *o, FILE *stream, const char *name,
+                    size_t nlen)
+{
+  struct row *r = o->row;
+  char *n;
+  size_t i;
+  if(!r || (o->input < INPUT_COMBINED))
+    return;
+  n = malloc(nlen + 1);
+  if(!n)
+    errorf(o, ERROR_MEM, "out of memory");
+  memcpy(n, name, nlen);
+  n[nlen] = 0;
+  if((o->input == INPUT_COMBINED) || (o->input == INPUT_PCAP)) {
+    const char *const *names = (o->input == INPUT_PCAP) ?
+      pcapfields : combinedfields;
+    for(i = 0; names[i]; i++)
+      if(!strcmp(names[i], n)) {
+        fwrite(r->raw[i], 1, r->rawlen[i], stream);
+        break;
+      }
+  }
+  else if(o->input == INPUT_NGINX) {
+    char *val = malloc(r->len + 1);
+    if(!val) {
+      free(n);
+      errorf(o, ERROR_MEM, "out of memory");
+    }
+    fputs(nginxfield(r, n, val) ? val : "", stream);
+    free(val);
+  }
+  else {
+    const char *ptr;
+    size_t len;
+    if((o->input == INPUT_WARC) ? warcfield(r, n, &ptr, &len) :
+       w3cfield(r, n, &ptr, &len))
+      fwrite(ptr, 1, len, stream);
+  }
+  free(n);
+}
+
+static void jsonString(FILE *stream, const char *in, size_t len,
+                       bool lowercase);
+
+/* output a value as a field, quoted if CSV or JSON needs it */
+static void rowvalue(struct option *o, const char *value)
+{
+  if(o->input == INPUT_JSON)
+    jsonString(o->out, value, strlen(value), false);
+  else if((o->input == INPUT_CSV) && strpbrk(value, ",\"\r\n")) {
+    fputc('\"', o->out);
+    for(; *value; value++) {
+      if(*value == '\"')
+        fputc('\"', o->out);
+      fputc(*value, o->out);
+    }
+    fputc('\"', o->out);
+  }
+  else
+    fputs(value, o->out);
+}
+
+/* output the row around the URL output */
+static void rowout(struct option *o, bool before)
+{
+  struct row *r = o->row;
+  if(o->format) {
+    /* the --get output is added as more columns */
+    if(before) {
+      fwrite(r->line, 1, r->len, o->out);
+      fputc(r->sep, o->out);
+    }
+  }
+  else if(before)
+    fwrite(r->line, 1, r->prelen, o->out);
+  else
+    fwrite(&r->line[r->postoff], 1, r->len - r->postoff, o->out);
+}
+
+static unsigned int set(CURLU *uh,
+                        struct option *o,
+                        struct curl_slist *list)
+{
+  struct curl_slist *node;
+  unsigned int mask = 0;
+  for(node = list; node; node = node->next) {
+    const struct var *v;
+    char *setline = node->data;
+    char *exp = rowexpand(o, setline);
+    v = setone(uh, exp ? exp : setline, o);
+    free(exp);
+    if(v) {
+      if(mask & (1 << v->part))
+        errorf(o, ERROR_SET,
+                     "duplicate --set for component %s", v->name);
+      mask |= (1 << v->part);
+    }
   }
   return mask; /* the set components */
 }
@@ -1152,14 +2998,13 @@ static void json(struct option *o, CURLU *uh)
   char *url;
   CURLUcode rc = geturlpart(o, 0, uh, CURLUPART_URL, &url);
   if(rc) {
-    trurl_cleanup_options(o);
     verify(o, ERROR_BADURL, "invalid url [%s]", curl_url_strerror(rc));
     return;
   }
-  printf("%s\n  {\n    \"url\": ", o->urls ? "," : "");
-  jsonString(stdout, url, strlen(url), false);
+  fprintf(o->out, "%s\n  {\n    \"url\": ", o->urls ? "," : "");
+  jsonString(o->out, url, strlen(url), false);
   curl_free(url);
-  fputs(",\n    \"parts\": {\n", stdout);
+  fputs(",\n    \"parts\": {\n", o->out);
   /* special error handling required to not print params array. */
   bool params_errors = false;
   for(i = 0; variables[i].name; i++) {
@@ -1191,13 +3036,13 @@ static void json(struct option *o, CURLU *uh)
       }
 
       if(!first)
-        fputs(",\n", stdout);
+        fputs(",\n", o->out);
       first = false;
-      printf("      \"%s\": ", variables[i].name);
+      fprintf(o->out, "      \"%s\": ", variables[i].name);
       if(dec)
-        jsonString(stdout, dec, (size_t)olen, false);
+        jsonString(o->out, dec, (size_t)olen, false);
       else
-        jsonString(stdout, part, strlen(part), false);
+        jsonString(o->out, part, strlen(part), false);
       curl_free(part);
       curl_free(dec);
     }
@@ -1206,12 +3051,13 @@ static void json(struct option *o, CURLU *uh)
         params_errors = true;
     }
   }
-  fputs("\n    }", stdout);
+  fputs("\n    }", o->out);
   first = true;
-  if(nqpairs && !params_errors) {
+  if(o->nqpairs && !params_errors) {
+    struct string *qpairsdec = o->qpairsdec;
     int j;
-    fputs(",\n    \"params\": [\n", stdout);
-    for(j = 0 ; j < nqpairs; j++) {
+    fputs(",\n    \"params\": [\n", o->out);
+    for(j = 0 ; j < o->nqpairs; j++) {
       const char *sep = memchr(qpairsdec[j].str, '=', qpairsdec[j].len);
       const char *value = sep ? sep + 1 : "";
       int value_len = (int) qpairsdec[j].len - (int)(value - qpairsdec[j].str);
@@ -1219,28 +3065,28 @@ static void json(struct option *o, CURLU *uh)
       if(!qpairsdec[j].len || !qpairsdec[j].str[0])
         continue;
       if(!first)
-        fputs(",\n", stdout);
+        fputs(",\n", o->out);
       first = false;
-      fputs("      {\n        \"key\": ", stdout);
-      jsonString(stdout, qpairsdec[j].str,
+      fputs("      {\n        \"key\": ", o->out);
+      jsonString(o->out, qpairsdec[j].str,
                  sep ? (size_t)(sep - qpairsdec[j].str) :
                        qpairsdec[j].len,
                  false);
-      fputs(",\n        \"value\": ", stdout);
-      jsonString(stdout, sep?value:"", sep?value_len:0, false);
-      fputs("\n      }", stdout);
+      fputs(",\n        \"value\": ", o->out);
+      jsonString(o->out, sep?value:"", sep?value_len:0, false);
+      fputs("\n      }", o->out);
     }
-    fputs("\n    ]", stdout);
+    fputs("\n    ]", o->out);
   }
-  fputs("\n  }", stdout);
+  fputs("\n  }", o->out);
 }
 
 /* --trim query="utm_*" */
-static bool trim(struct option *o)
+static bool trim(struct option *o, struct curl_slist *list)
 {
   bool query_is_modified = false;
   struct curl_slist *node;
-  for(node = o->trim_list; node; node = node->next) {
+  for(node = list; node; node = node->next) {
     char *ptr = node->data;
     if(ptr) {
       /* 'ptr' should be a fixed string or a pattern ending with an
@@ -1269,8 +3115,8 @@ static bool trim(struct option *o)
           inslen--;
       }
 
-      for(i = 0 ; i < nqpairs; i++) {
-        char *q = qpairs[i].str;
+      for(i = 0 ; i < o->nqpairs; i++) {
+        char *q = o->qpairs[i].str;
         char *sep = strchr(q, '=');
         size_t qlen;
         if(sep)
@@ -1281,12 +3127,12 @@ static bool trim(struct option *o)
         if((pattern && (inslen <= qlen) && !casecompare(q, ptr, inslen)) ||
            (!pattern && (inslen == qlen) && !casecompare(q, ptr, inslen))) {
           /* this qpair should be stripped out */
-          free(qpairs[i].str);
-          free(qpairsdec[i].str);
-          qpairs[i].str = xstrdup(o, ""); /* marked as deleted */
-          qpairs[i].len = 0;
-          qpairsdec[i].str = xstrdup(o, ""); /* marked as deleted */
-          qpairsdec[i].len = 0;
+          free(o->qpairs[i].str);
+          free(o->qpairsdec[i].str);
+          o->qpairs[i].str = xstrdup(o, ""); /* marked as deleted */
+          o->qpairs[i].len = 0;
+          o->qpairsdec[i].str = xstrdup(o, ""); /* marked as deleted */
+          o->qpairsdec[i].len = 0;
           query_is_modified = true;
         }
       }
@@ -1313,15 +3159,6 @@ static char *decodequery(char *str, size_t len, int *olen)
   return curl_easy_unescape(NULL, str, (int)len, olen);
 }
 
-/* the unusual thing here is that we let '*' remain as-is */
-#define ISURLPUNTCS(x) (((x) == '-') || ((x) == '.') || ((x) == '_') || \
-                        ((x) == '~') || ((x) == '*'))
-#define ISUPPER(x)  (((x) >= 'A') && ((x) <= 'Z'))
-#define ISLOWER(x)  (((x) >= 'a') && ((x) <= 'z'))
-#define ISDIGIT(x)  (((x) >= '0') && ((x) <= '9'))
-#define ISALNUM(x)  (ISDIGIT(x) || ISLOWER(x) || ISUPPER(x))
-#define ISUNRESERVED(x) (ISALNUM(x) || ISURLPUNTCS(x))
-
 static char *encodequery(char *str, size_t len)
 {
   /* to handle ' ' to '+' escaping we cannot use libcurl's URL encode
@@ -1495,39 +3332,38 @@ static struct string *memdupdec(char *source, size_t len, bool json)
 }
 
 
-static void freeqpairs(void)
+static void freeqpairs(struct option *o)
 {
   int i;
-  for(i = 0; i<nqpairs; i++) {
-    if(qpairs[i].len) {
-      free(qpairs[i].str);
-      qpairs[i].str = NULL;
-      free(qpairsdec[i].str);
-      qpairsdec[i].str = NULL;
-    }
+  for(i = 0; i<o->nqpairs; i++) {
+    /* the deleted ones are allocated empty strings */
+    free(o->qpairs[i].str);
+    o->qpairs[i].str = NULL;
+    free(o->qpairsdec[i].str);
+    o->qpairsdec[i].str = NULL;
   }
-  nqpairs = 0;
+  o->nqpairs = 0;
 }
 
 /* store the pair both encoded and decoded, return if modified */
-static bool addqpair(char *pair, size_t len, bool json)
+static bool addqpair(struct option *o, char *pair, size_t len)
 {
   struct string *p = NULL;
   struct string *pdec = NULL;
   bool modified = false;
-  if(nqpairs < MAX_QPAIRS) {
+  if(o->nqpairs < MAX_QPAIRS) {
     p = memdupzero(pair, len, &modified);
-    pdec = memdupdec(pair, len, json);
+    pdec = memdupdec(pair, len, o->jsonout);
     if(p && pdec) {
-      qpairs[nqpairs].str = p->str;
-      qpairs[nqpairs].len = p->len;
-      qpairsdec[nqpairs].str = pdec->str;
-      qpairsdec[nqpairs].len = pdec->len;
-      nqpairs++;
+      o->qpairs[o->nqpairs].str = p->str;
+      o->qpairs[o->nqpairs].len = p->len;
+      o->qpairsdec[o->nqpairs].str = pdec->str;
+      o->qpairsdec[o->nqpairs].len = pdec->len;
+      o->nqpairs++;
     }
   }
   else
-    warnf("too many query pairs");
+    warnf(o, "too many query pairs");
 
   if(pdec)
     free(pdec);
@@ -1541,8 +3377,8 @@ static bool extractqpairs(CURLU *uh, struct option *o)
 {
   char *q = NULL;
   bool modified = false;
-  memset(qpairs, 0, sizeof(qpairs));
-  nqpairs = 0;
+  memset(o->qpairs, 0, sizeof(o->qpairs));
+  o->nqpairs = 0;
   /* extract the query */
   if(!curl_url_get(uh, CURLUPART_QUERY, &q, 0)) {
     char *p = q;
@@ -1554,7 +3390,7 @@ static bool extractqpairs(CURLU *uh, struct option *o)
         len = strlen(p);
       else
         len = amp - p;
-      modified |= addqpair(p, len, o->jsonout);
+      modified |= addqpair(o, p, len);
       if(amp)
         p = amp + 1;
       else
@@ -1569,11 +3405,11 @@ static void qpair2query(CURLU *uh, struct option *o)
 {
   int i;
   char *nq = NULL;
-  for(i = 0; i<nqpairs; i++) {
+  for(i = 0; i<o->nqpairs; i++) {
     char *oldnq = nq;
     nq = curl_maprintf("%s%s%s", nq ? nq : "",
-                       (nq && *nq && *(qpairs[i].str)) ? o->qsep : "",
-                       qpairs[i].str);
+                       (nq && *nq && *(o->qpairs[i].str)) ? o->qsep : "",
+                       o->qpairs[i].str);
     curl_free(oldnq);
   }
   if(nq) {
@@ -1605,18 +3441,19 @@ static bool sortquery(struct option *o)
 {
   if(o->sort_query) {
     /* not these two lists may no longer be the same order after the sort */
-    qsort(&qpairs[0], nqpairs, sizeof(struct string), cmpfunc);
-    qsort(&qpairsdec[0], nqpairs, sizeof(struct string), cmpfunc);
+    qsort(&o->qpairs[0], o->nqpairs, sizeof(struct string), cmpfunc);
+    qsort(&o->qpairsdec[0], o->nqpairs, sizeof(struct string), cmpfunc);
     return true;
   }
   return false;
 }
 
-static bool replace(struct option *o)
+static bool replace(struct option *o, struct curl_slist *list,
+                    bool force_replace)
 {
   bool query_is_modified = false;
   struct curl_slist *node;
-  for(node = o->replace_list; node; node = node->next) {
+  for(node = list; node; node = node->next) {
     struct string key;
     struct string value;
     bool replaced = false;
@@ -1632,19 +3469,19 @@ static bool replace(struct option *o)
       value.str = NULL;
       value.len = 0;
     }
-    for(i = 0; i < nqpairs; i++) {
-      char *q = qpairs[i].str;
+    for(i = 0; i < o->nqpairs; i++) {
+      char *q = o->qpairs[i].str;
       /* not the correct query, move on */
       if(strncmp(q, key.str, key.len))
         continue;
-      free(qpairs[i].str);
-      free(qpairsdec[i].str);
+      free(o->qpairs[i].str);
+      free(o->qpairsdec[i].str);
       /* this is a duplicate remove it. */
       if(replaced) {
-        qpairs[i].len = 0;
-        qpairs[i].str = xstrdup(o, "");
-        qpairsdec[i].len = 0;
-        qpairsdec[i].str = xstrdup(o, "");
+        o->qpairs[i].len = 0;
+        o->qpairs[i].str = xstrdup(o, "");
+        o->qpairsdec[i].len = 0;
+        o->qpairsdec[i].str = xstrdup(o, "");
         continue;
       }
       struct string *pdec =
@@ -1652,17 +3489,17 @@ static bool replace(struct option *o)
       struct string *p = memdupzero(key.str, key.len + value.len +
                                     (value.str ? 1 : 0),
                                     &query_is_modified);
-      qpairs[i].len = p->len;
-      qpairs[i].str = p->str;
-      qpairsdec[i].len = pdec->len;
-      qpairsdec[i].str = pdec->str;
+      o->qpairs[i].len = p->len;
+      o->qpairs[i].str = p->str;
+      o->qpairsdec[i].len = pdec->len;
+      o->qpairsdec[i].str = pdec->str;
       free(pdec);
       free(p);
       query_is_modified = replaced = true;
     }
 
-    if(!replaced && o->force_replace) {
-      addqpair(key.str, strlen(key.str), o->jsonout);
+    if(!replaced && force_replace) {
+      addqpair(o, key.str, strlen(key.str));
       query_is_modified = true;
     }
   }
@@ -1765,43 +3602,778 @@ static void normalize_part(struct option *o, CURLU *uh, CURLUPart part)
 }
 
 
-static void singleurl(struct option *o,
-                      const char *url, /* might be NULL */
-                      struct iterinfo *iinfo,
-                      struct curl_slist *iter)
+/*
+ * --rules: actions to apply to URLs depending on their host and path,
+ * loaded once from a file. The rules are indexed in a hash table on host and
+ * path prefix, so each URL only needs one lookup per distinct path prefix
+ * length used in the file no matter how many rules there are.
+ */
+
+#define RULE_NONE ((size_t)-1)
+#define MAX_RULELINE 4096
+
+struct rule {
+  char *host;   /* lowercase, NULL matches any host */
+  char *prefix; /* path prefix, NULL matches any path */
+  size_t prefixlen;
+  size_t hnext; /* next rule in the same hash bucket */
+  struct curl_slist *set_list;
+  struct curl_slist *append_path;
+  struct curl_slist *append_query;
+  struct curl_slist *trim_list;
+  struct curl_slist *replace_list;
+  bool force_replace;
+};
+
+struct ruleset {
+  struct rule *rule;
+  size_t nrules;
+  size_t arules;     /* allocated */
+  size_t *bucket;    /* first rule in each hash bucket */
+  size_t nbuckets;   /* a power of two */
+  size_t *prefixlen; /* distinct path prefix lengths, ascending */
+  size_t nprefixlen;
+  size_t *matched;   /* the rules matching the current URL, in file order */
+  size_t nmatched;
+};
+
+static void rulesfree(struct ruleset *rs)
 {
-  CURLU *uh = iinfo->uh;
-  bool first_lap = true;
-  if(!uh) {
-    uh = curl_url();
-    if(!uh)
-      errorf(o, ERROR_MEM, "out of memory");
-    if(url) {
-      CURLUcode rc = seturl(o, uh, url);
-      if(rc) {
+  size_t i;
+  if(!rs)
+    return;
+  for(i = 0; i < rs->nrules; i++) {
+    struct rule *r = &rs->rule[i];
+    free(r->host);
+    free(r->prefix);
+    curl_slist_free_all(r->set_list);
+    curl_slist_free_all(r->append_path);
+    curl_slist_free_all(r->append_query);
+    curl_slist_free_all(r->trim_list);
+    curl_slist_free_all(r->replace_list);
+  }
+  free(rs->rule);
+  free(rs->bucket);
+  free(rs->prefixlen);
+  free(rs->matched);
+  free(rs);
+}
+
+/* FNV-1a of the host and the path prefix */
+static size_t rulehash(const char *host, const char *prefix, size_t plen)
+{
+  uint32_t h = 2166136261u;
+  if(host)
+    while(*host) {
+      h ^= (unsigned char)*host++;
+      h *= 16777619u;
+    }
+  h ^= '/';
+  h *= 16777619u;
+  while(plen--) {
+    h ^= (unsigned char)*prefix++;
+    h *= 16777619u;
+  }
+  return (size_t)h;
+}
+
+static int cmpsize(const void *p1, const void *p2)
+{
+  size_t s1 = *(const size_t *)p1;
+  size_t s2 = *(const size_t *)p2;
+  return (s1 > s2) - (s1 < s2);
+}
+
+/* return the next whitespace separated word in the line, or NULL */
+static char *nextword(char **linep)
+{
+  char *word = *linep;
+  while((*word == ' ') || (*word == '\t'))
+    word++;
+  if(!*word)
+    return NULL;
+  *linep = word;
+  while(**linep && (**linep != ' ') && (**linep != '\t'))
+    (*linep)++;
+  if(**linep)
+    *(*linep)++ = 0;
+  return word;
+}
+
+/* parse one rule line: [match] [action] [argument] ... */
+static void ruleparse(struct option *o, struct ruleset *rs, char *line,
+                      const char *file, int lineno)
+{
+  struct rule *r;
+  char *match;
+  char *tok;
+  char *slash;
+
+  match = nextword(&line);
+  if(!match || (match[0] == '#'))
+    /* empty or comment */
+    return;
+
+  if(rs->nrules == rs->arules) {
+    size_t n = rs->arules ? rs->arules * 2 : 64;
+    struct rule *nr = realloc(rs->rule, n * sizeof(struct rule));
+    if(!nr)
+      errorf(o, ERROR_MEM, "out of memory");
+    rs->rule = nr;
+    rs->arules = n;
+  }
+  r = &rs->rule[rs->nrules++];
+  memset(r, 0, sizeof(struct rule));
+
+  if(strcmp(match, "*")) {
+    slash = strchr(match, '/');
+    if(slash) {
+      r->prefix = xstrdup(o, slash);
+      r->prefixlen = strlen(slash);
+      *slash = 0;
+    }
+    if(*match) {
+      char *h;
+      r->host = xstrdup(o, match);
+      for(h = r->host; *h; h++)
+        if(ISUPPER(*h))
+          *h |= ('a' - 'A');
+    }
+  }
+
+  while((tok = nextword(&line))) {
+    char *arg = NULL;
+    if(tok[0] == '#')
+      /* the rest is a comment */
+      break;
+    if(!strncmp(tok, "--", 2)) {
+      arg = strchr(tok, '=');
+      if(arg)
+        *arg++ = 0;
+    }
+    if(!arg)
+      arg = nextword(&line);
+    if(!arg)
+      errorf(o, ERROR_RULES, "%s:%d: missing argument for %s",
+             file, lineno, tok);
+    if(!strcmp(tok, "-s") || !strcmp(tok, "--set"))
+      listadd(&r->set_list, arg);
+    else if(!strcmp(tok, "-a") || !strcmp(tok, "--append"))
+      appendadd(o, &r->append_path, &r->append_query, arg);
+    else if(!strcmp(tok, "--qtrim"))
+      listadd(&r->trim_list, arg);
+    else if(!strcmp(tok, "--replace"))
+      replaceadd(o, &r->replace_list, arg);
+    else if(!strcmp(tok, "--replace-append")) {
+      replaceadd(o, &r->replace_list, arg);
+      r->force_replace = true;
+    }
+    else
+      errorf(o, ERROR_RULES, "%s:%d: unsupported rule action: %s",
+             file, lineno, tok);
+  }
+}
+
+/* build the hash table index */
+static void rulesindex(struct option *o, struct ruleset *rs)
+{
+  size_t i;
+  rs->nbuckets = 16;
+  while(rs->nbuckets < rs->nrules * 2)
+    rs->nbuckets *= 2;
+  rs->bucket = malloc(rs->nbuckets * sizeof(size_t));
+  rs->prefixlen = malloc((rs->nrules + 1) * sizeof(size_t));
+  rs->matched = malloc((rs->nrules + 1) * sizeof(size_t));
+  if(!rs->bucket || !rs->prefixlen || !rs->matched)
+    errorf(o, ERROR_MEM, "out of memory");
+  for(i = 0; i < rs->nbuckets; i++)
+    rs->bucket[i] = RULE_NONE;
+
+  for(i = rs->nrules; i--;) {
+    struct rule *r = &rs->rule[i];
+    size_t b = rulehash(r->host, r->prefix, r->prefixlen) &
+      (rs->nbuckets - 1);
+    r->hnext = rs->bucket[b];
+    rs->bucket[b] = i;
+    if(r->prefix)
+      rs->prefixlen[rs->nprefixlen++] = r->prefixlen;
+  }
+
+  /* keep only the distinct prefix lengths */
+  if(rs->nprefixlen) {
+    size_t n = 1;
+    qsort(rs->prefixlen, rs->nprefixlen, sizeof(size_t), cmpsize);
+    for(i = 1; i < rs->nprefixlen; i++)
+      if(rs->prefixlen[i] != rs->prefixlen[n - 1])
+        rs->prefixlen[n++] = rs->prefixlen[i];
+    rs->nprefixlen = n;
+  }
+}
+
+static void rulesload(struct option *o, const char *file)
+{
+  char buffer[MAX_RULELINE];
+  int lineno = 0;
+  FILE *f = fopen(file, "rt");
+  if(!f)
+    errorf(o, ERROR_FILE, "--rules %s not found", file);
+  o->rules = calloc(1, sizeof(struct ruleset));
+  if(!o->rules) {
+    fclose(f);
+    errorf(o, ERROR_MEM, "out of memory");
+  }
+  while(fgets(buffer, sizeof(buffer), f)) {
+    char *eol = strchr(buffer, '\n');
+    lineno++;
+    if(eol)
+      *eol = 0;
+    else if(!feof(f)) {
+      fclose(f);
+      errorf(o, ERROR_RULES, "%s:%d: line too long", file, lineno);
+    }
+    eol = strchr(buffer, '\r');
+    if(eol)
+      *eol = 0;
+    ruleparse(o, o->rules, buffer, file, lineno);
+  }
+  fclose(f);
+  rulesindex(o, o->rules);
+}
+
+/* add the rules for this host and prefix to the matched ones */
+static void ruleslookup(struct ruleset *rs, const char *host,
+                        const char *prefix, size_t plen)
+{
+  size_t i = rs->bucket[rulehash(host, prefix, plen) & (rs->nbuckets - 1)];
+  for(; i != RULE_NONE; i = rs->rule[i].hnext) {
+    struct rule *r = &rs->rule[i];
+    if((host ? (r->host && !strcmp(r->host, host)) : !r->host) &&
+       (plen ? (r->prefix && (r->prefixlen == plen) &&
+                !memcmp(r->prefix, prefix, plen)) : !r->prefix))
+      rs->matched[rs->nmatched++] = i;
+  }
+}
+
+/* find the rules matching the URL */
+static void rulesmatch(struct ruleset *rs, CURLU *uh)
+{
+  char *host = NULL;
+  char *path = NULL;
+  size_t pathlen = 0;
+  int h;
+
+  rs->nmatched = 0;
+  if(!curl_url_get(uh, CURLUPART_HOST, &host, 0)) {
+    char *p;
+    for(p = host; *p; p++)
+      if(ISUPPER(*p))
+        *p |= ('a' - 'A');
+  }
+  if(!curl_url_get(uh, CURLUPART_PATH, &path, 0))
+    pathlen = strlen(path);
+
+  /* first the rules for this host, then the ones for any host */
+  for(h = host ? 0 : 1; h < 2; h++) {
+    const char *key = h ? NULL : host;
+    size_t i;
+    ruleslookup(rs, key, NULL, 0);
+    for(i = 0; (i < rs->nprefixlen) && (rs->prefixlen[i] <= pathlen); i++)
+      ruleslookup(rs, key, path, rs->prefixlen[i]);
+  }
+  curl_free(host);
+  curl_free(path);
+
+  /* apply them in file order */
+  qsort(rs->matched, rs->nmatched, sizeof(size_t), cmpsize);
+}
+
+#define NMATCHED(o) ((o)->rules ? (o)->rules->nmatched : 0)
+#define MATCHED(o,i) (&(o)->rules->rule[(o)->rules->matched[i]])
+
+/* append path segments */
+static char *pathappend(char *opath, struct curl_slist *list,
+                        bool *modified)
+{
+  struct curl_slist *p;
+  for(p = list; p; p = p->next) {
+    char *apath = p->data;
+    char *npath;
+    size_t olen;
+
+    /* does the existing path end with a slash, then don't
+       add one in between */
+    olen = strlen(opath);
+
+    /* append the new segment */
+    npath = curl_maprintf("%s%s%s", opath,
+                          opath[olen-1] == '/' ? "" : "/",
+                          apath);
+    curl_free(opath);
+    opath = npath;
+    *modified = true;
+  }
+  return opath;
+}
+
+/*
+ * A "simple" URL is one that libcurl and trurl's normalization would not
+ * change at all: http or https, a lowercase hostname, no port or userinfo,
+ * nothing that needs URL encoding or decoding and no dot segments. Such URLs
+ * can be output directly from their input bytes when nothing on the command
+ * line asks for modifications.
+ */
+
+#define MAX_LINE 4096 /* arbitrary max */
+
+/* byte classes, see RFC 3986 */
+#define BC_UNRESERVED 0x01
+#define BC_DELIM      0x02 /* gen-delims */
+#define BC_SUBDELIM   0x04
+#define BC_PERCENT    0x08
+#define BC_UNSAFE     0x10 /* space, controls, non-ASCII and the rest */
+
+static const unsigned char byteclass[256] = {
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 4, 16, 2, 4, 8, 4, 4,
+4, 4, 4, 4, 4, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 4, 16, 4, 16, 2, 2,
+1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+2, 16, 2, 16, 1, 16, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+1, 1, 1, 1, 1, 1, 1, 16, 16, 16, 1, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+16, 16, 16, 16, 16
+};
+
+#define ISRFCUNRESERVED(x) (byteclass[(unsigned char)(x)] & BC_UNRESERVED)
+
+/* component spans of a simple URL, relative to the start of it */
+struct urlspans {
+  uint16_t schemelen;
+  uint16_t hostlen;  /* the host follows "://" */
+  uint16_t pathoff;
+  uint16_t pathlen;  /* zero means no path */
+  uint16_t queryoff;
+  uint16_t querylen; /* zero means no query */
+  uint16_t fragoff;
+  uint16_t fraglen;  /* zero means no fragment */
+};
+
+/* all byte classes used in the string */
+static unsigned char urlclass(const char *url, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)url;
+  unsigned char cls = 0;
+  size_t i;
+  for(i = 0; i < len; i++)
+    cls |= byteclass[p[i]];
+  return cls;
+}
+
+/* split a simple URL into its component spans, return false if it is not a
+   simple URL */
+static bool simplesplit(struct option *o, const char *line, size_t len,
+                        unsigned char cls, struct urlspans *sp)
+{
+  size_t p;
+  size_t start;
+  char qsep = o->qsep[0];
+
+  if((cls & (BC_PERCENT | BC_UNSAFE)) || (len >= MAX_LINE))
+    return false;
+
+  if((len > 8) && !memcmp(line, "https://", 8))
+    sp->schemelen = 5;
+  else if((len > 7) && !memcmp(line, "http://", 7))
+    sp->schemelen = 4;
+  else
+    return false;
+
+  /* the hostname: lowercase letters, digits, dashes and single dots. Start
+     with a letter to not be mistaken for an IPv4 address. */
+  start = p = sp->schemelen + 3;
+  if(!ISLOWER(line[p]))
+    return false;
+  for(; p < len; p++) {
+    char c = line[p];
+    if((c == '/') || (c == '?') || (c == '#'))
+      break;
+    if(c == '.') {
+      if(line[p - 1] == '.')
+        return false;
+    }
+    else if(!ISLOWER(c) && !ISDIGIT(c) && (c != '-'))
+      return false;
+  }
+  if(line[p - 1] == '.')
+    return false;
+  sp->hostlen = (uint16_t)(p - start);
+
+  /* the path: unreserved and slashes, no dot segments */
+  sp->pathoff = (uint16_t)p;
+  if((p < len) && (line[p] == '/')) {
+    size_t seg = p + 1;
+    for(p++; p <= len; p++) {
+      char c = (p < len) ? line[p] : '\0';
+      if(!c || (c == '/') || (c == '?') || (c == '#')) {
+        size_t slen = p - seg;
+        if(((slen == 1) && (line[seg] == '.')) ||
+           ((slen == 2) && (line[seg] == '.') && (line[seg + 1] == '.')))
+          return false;
+        if(c != '/')
+          break;
+        seg = p + 1;
+      }
+      else if(!ISRFCUNRESERVED(c))
+        return false;
+    }
+  }
+  sp->pathlen = (uint16_t)(p - sp->pathoff);
+
+  /* the query: non-empty pairs of unreserved with a single equals sign */
+  sp->querylen = 0;
+  if((p < len) && (line[p] == '?')) {
+    int equals = 0;
+    size_t pair;
+    start = pair = ++p;
+    for(; p < len; p++) {
+      char c = line[p];
+      if(c == '#')
+        break;
+      if(c == qsep) {
+        if(p == pair)
+          return false;
+        pair = p + 1;
+        equals = 0;
+      }
+      else if(c == '=') {
+        if(equals++)
+          return false;
+      }
+      else if(!ISRFCUNRESERVED(c) && (c != '*') && (c != '+'))
+        return false;
+    }
+    if(p == pair)
+      return false;
+    sp->queryoff = (uint16_t)start;
+    sp->querylen = (uint16_t)(p - start);
+  }
+
+  /* the fragment: unreserved only */
+  sp->fraglen = 0;
+  if((p < len) && (line[p] == '#')) {
+    start = ++p;
+    for(; p < len; p++)
+      if(!ISRFCUNRESERVED(line[p]))
+        return false;
+    if(p == start)
+      return false;
+    sp->fragoff = (uint16_t)start;
+    sp->fraglen = (uint16_t)(p - start);
+  }
+  return p == len;
+}
+
+/* output the full URL of a simple URL */
+static void simpleurl(FILE *stream, const char *line, size_t len,
+                      const struct urlspans *sp)
+{
+  if(sp->pathlen)
+    /* already canonical, output the input as-is */
+    fwrite(line, 1, len, stream);
+  else {
+    /* insert the slash libcurl adds */
+    fwrite(line, 1, sp->pathoff, stream);
+    fputc('/', stream);
+    fwrite(&line[sp->pathoff], 1, len - sp->pathoff, stream);
+  }
+}
+
+static void simpleget(struct option *o, const char *line, size_t len,
+                      const struct urlspans *sp)
+{
+  FILE *stream = o->out;
+  int s;
+  if(!o->fastget) {
+    /* default output is full URL */
+    simpleurl(stream, line, len, sp);
+    fputc(o->delim, stream);
+    return;
+  }
+  for(s = 0; s < o->fastget->nseg; s++) {
+    const struct fastseg *seg = &o->fastget->seg[s];
+    fwrite(&o->fastget->lit[seg->litoff], 1, seg->litlen, stream);
+    switch(seg->part) {
+    case CURLUPART_URL:
+      simpleurl(stream, line, len, sp);
+      break;
+    case CURLUPART_SCHEME:
+      fwrite(line, 1, sp->schemelen, stream);
+      break;
+    case CURLUPART_HOST:
+      fwrite(&line[sp->schemelen + 3], 1, sp->hostlen, stream);
+      break;
+    case CURLUPART_PATH:
+      if(sp->pathlen)
+        fwrite(&line[sp->pathoff], 1, sp->pathlen, stream);
+      else
+        fputc('/', stream);
+      break;
+    case CURLUPART_QUERY:
+      fwrite(&line[sp->queryoff], 1, sp->querylen, stream);
+      break;
+    case CURLUPART_FRAGMENT:
+      fwrite(&line[sp->fragoff], 1, sp->fraglen, stream);
+      break;
+    default:
+      /* not present in a simple URL */
+      break;
+    }
+  }
+  fputc(o->delim, stream);
+}
+
+/* compile the --get format for the fast path, return NULL if it uses
+   anything the fast path cannot provide */
+static struct fastfmt *fastformat(const char *ptr)
+{
+  struct fastfmt *f = calloc(1, sizeof(struct fastfmt));
+  char startbyte = 0;
+  char endbyte = 0;
+  size_t l = 0;
+  size_t litstart = 0;
+
+  if(!f)
+    return NULL;
+  f->lit = malloc(strlen(ptr) + 1);
+  if(!f->lit)
+    goto fail;
+
+  while(*ptr) {
+    if(!startbyte && (('{' == *ptr) || ('[' == *ptr))) {
+      startbyte = *ptr;
+      endbyte = ('{' == *ptr) ? '}' : ']';
+    }
+    if(startbyte == *ptr) {
+      if(startbyte == ptr[1]) {
+        /* an escaped {-letter */
+        f->lit[l++] = startbyte;
+        ptr += 2;
+      }
+      else {
+        const char *end = strchr(ptr, endbyte);
+        struct fastseg *seg;
+        int part;
+        ptr++;
+        if(!end || (f->nseg == MAX_FASTSEGS - 1) ||
+           memchr(ptr, ':', end - ptr))
+          /* syntax error, too many or modifiers used */
+          goto fail;
+        if((end - ptr == 3) && !strncmp(ptr, "url", 3))
+          part = CURLUPART_URL;
+        else {
+          const struct var *v = comp2var(ptr, end - ptr);
+          if(!v)
+            goto fail;
+          part = v->part;
+        }
+        seg = &f->seg[f->nseg++];
+        seg->litoff = litstart;
+        seg->litlen = l - litstart;
+        seg->part = part;
+        litstart = l;
+        ptr = end + 1;
+      }
+    }
+    else if('\\' == *ptr && ptr[1]) {
+      switch(ptr[1]) {
+      case 'r':
+        f->lit[l++] = '\r';
+        break;
+      case 'n':
+        f->lit[l++] = '\n';
+        break;
+      case 't':
+        f->lit[l++] = '\t';
+        break;
+      case '\\':
+      case '{':
+      case '[':
+        f->lit[l++] = ptr[1];
+        break;
+      default:
+        /* unknown, just output this */
+        f->lit[l++] = ptr[0];
+        f->lit[l++] = ptr[1];
+        break;
+      }
+      ptr += 2;
+    }
+    else
+      f->lit[l++] = *ptr++;
+  }
+  f->seg[f->nseg].litoff = litstart;
+  f->seg[f->nseg].litlen = l - litstart;
+  f->seg[f->nseg].part = -1;
+  f->nseg++;
+  return f;
+fail:
+  free(f->lit);
+  free(f);
+  return NULL;
+}
+
+/* decide once if simple URLs can be output without involving libcurl */
+static void fastsetup(struct option *o)
+{
+  if(o->jsonout || o->set_list || o->append_path || o->append_query ||
+     o->iter_list || o->redirect || o->trim_list || o->replace_list ||
+     o->sort_query || o->punycode || o->puny2idn || o->default_port ||
+     o->curl || o->rules || o->base || o->row || (o->qsep[0] == '='))
+    return;
+  if(o->format) {
+    o->fastget = fastformat(o->format);
+    o->fastpath = !!o->fastget;
+  }
+  else
+    /* the default output */
+    o->fastpath = true;
+}
+
+/* output the URL directly if it is simple, return true if done */
+static bool passthrough(struct option *o, const char *url)
+{
+  struct urlspans sp;
+  size_t len = strlen(url);
+  if(!simplesplit(o, url, len, urlclass(url, len), &sp))
+    return false;
+  simpleget(o, url, len, &sp);
+  if(o->out == stdout)
+    fflush(stdout);
+  o->urls++;
+  return true;
+}
+
+/*
+ * Resolve a relative reference against the --base URL, or against the base
+ * on the same line when given as base<TAB>relative, which is the only one
+ * without --base. The bases are only parsed once, each URL is a copy of the
+ * parsed base with the reference applied.
+ */
+static CURLU *relativeurl(struct option *o, const char *url)
+{
+  CURLU *base = o->htmlbaseuh ? o->htmlbaseuh : o->baseuh;
+  CURLU *uh;
+  CURLUcode rc;
+  const char *rel = url;
+  const char *tab = strchr(url, '\t');
+
+  if(tab) {
+    size_t blen = tab - url;
+    rel = tab + 1;
+    if(!o->pairbase || strncmp(o->pairbase, url, blen) ||
+       o->pairbase[blen]) {
+      /* a new base, links for the same page tend to come together */
+      free(o->pairbase);
+      curl_url_cleanup(o->pairuh);
+      o->pairuh = NULL;
+      o->pairbase = malloc(blen + 1);
+      if(!o->pairbase)
+        errorf(o, ERROR_MEM, "out of memory");
+      memcpy(o->pairbase, url, blen);
+      o->pairbase[blen] = 0;
+      uh = curl_url();
+      if(!uh)
+        errorf(o, ERROR_MEM, "out of memory");
+      rc = seturl(o, uh, o->pairbase);
+      if(rc)
         curl_url_cleanup(uh);
-        verify(o, ERROR_BADURL, "%s [%s]", curl_url_strerror(rc), url);
+      else
+        o->pairuh = uh;
+    }
+    base = o->pairuh;
+    if(!base) {
+      verify(o, ERROR_BADURL, "invalid base: %s", o->pairbase);
+      return NULL;
+    }
+  }
+
+  uh = curl_url_dup(base);
+  if(!uh)
+    errorf(o, ERROR_MEM, "out of memory");
+  rc = seturl(o, uh, rel);
+  if(rc) {
+    curl_url_cleanup(uh);
+    verify(o, ERROR_BADURL, "%s [%s]", curl_url_strerror(rc), url);
+    return NULL;
+  }
+  return uh;
+}
+
+static void singleurl(struct option *o,
+                      const char *url, /* might be NULL */
+                      struct iterinfo *iinfo,
+                      struct curl_slist *iter)
+{
+  CURLU *uh = iinfo->uh;
+  bool first_lap = true;
+  if(!uh) {
+    /* base<TAB>relative lines also work without --base */
+    bool relative = o->baseuh || o->htmlbaseuh || (url && strchr(url, '\t'));
+    if(url && o->fastpath && passthrough(o, url))
+      /* no rewriting needed */
+      return;
+    if(url && relative) {
+      uh = relativeurl(o, url);
+      if(!uh)
         return;
+    }
+    else {
+      uh = curl_url();
+      if(!uh)
+        errorf(o, ERROR_MEM, "out of memory");
+    }
+    /* errorf() and verify() clean it up if they do not return */
+    o->uh = uh;
+    if(url) {
+      CURLUcode rc;
+      if(!relative) {
+        rc = seturl(o, uh, url);
+        if(rc) {
+          verify(o, ERROR_BADURL, "%s [%s]", curl_url_strerror(rc), url);
+          curl_url_cleanup(uh);
+          o->uh = NULL;
+          return;
+        }
       }
       if(o->redirect) {
         rc = seturl(o, uh, o->redirect);
         if(rc) {
-          curl_url_cleanup(uh);
           verify(o, ERROR_BADURL, "invalid redirection: %s [%s]",
                  curl_url_strerror(rc), o->redirect);
+          curl_url_cleanup(uh);
+          o->uh = NULL;
           return;
         }
       }
     }
+    if(o->rules)
+      rulesmatch(o->rules, uh);
   }
   do {
     struct curl_slist *p;
     bool url_is_invalid = false;
     bool query_is_modified = false;
     unsigned setmask = 0;
+    size_t r;
 
     /* set everything */
-    setmask = set(uh, o);
+    setmask = set(uh, o, o->set_list);
+    for(r = 0; r < NMATCHED(o); r++)
+      setmask |= set(uh, o, MATCHED(o, r)->set_list);
 
     if(iter) {
       char iterbuf[1024];
@@ -1829,21 +4401,15 @@ static void singleurl(struct option *o,
         iinfo->part = part;
         iinfo->plen = plen;
         v = comp2var(part, plen);
-        if(!v) {
-          curl_url_cleanup(uh);
+        if(!v)
           errorf(o, ERROR_ITER, "bad component for iterate");
-        }
-        if(iinfo->varmask & (1<<v->part)) {
-          curl_url_cleanup(uh);
+        if(iinfo->varmask & (1<<v->part))
           errorf(o, ERROR_ITER,
                        "duplicate component for iterate: %s", v->name);
-        }
-        if(setmask & (1 << v->part)) {
-          curl_url_cleanup(uh);
+        if(setmask & (1 << v->part))
           errorf(o, ERROR_ITER,
                  "duplicate --iterate and --set for component %s",
                  v->name);
-        }
       }
       else {
         part = iinfo->part;
@@ -1876,7 +4442,7 @@ static void singleurl(struct option *o,
       }
     }
 
-    if(first_lap) {
+    if(first_lap && NEEDPART(o, CURLUPART_PATH)) {
       /* extract the current path */
       char *opath;
       char *cpath;
@@ -1885,23 +4451,10 @@ static void singleurl(struct option *o,
         errorf(o, ERROR_MEM, "out of memory");
 
       /* append path segments */
-      for(p = o->append_path; p; p = p->next) {
-        char *apath = p->data;
-        char *npath;
-        size_t olen;
-
-        /* does the existing path end with a slash, then don't
-           add one in between */
-        olen = strlen(opath);
-
-        /* append the new segment */
-        npath = curl_maprintf("%s%s%s", opath,
-                              opath[olen-1] == '/' ? "" : "/",
-                              apath);
-        curl_free(opath);
-        opath = npath;
-        path_is_modified = true;
-      }
+      opath = pathappend(opath, o->append_path, &path_is_modified);
+      for(r = 0; r < NMATCHED(o); r++)
+        opath = pathappend(opath, MATCHED(o, r)->append_path,
+                           &path_is_modified);
       cpath = canonical_path(opath);
       if(!cpath)
         errorf(o, ERROR_MEM, "out of memory");
@@ -1920,51 +4473,68 @@ static void singleurl(struct option *o,
           errorf(o, ERROR_MEM, "out of memory");
       }
       curl_free(opath);
-
-      normalize_part(o, uh, CURLUPART_FRAGMENT);
-      normalize_part(o, uh, CURLUPART_USER);
-      normalize_part(o, uh, CURLUPART_PASSWORD);
-      normalize_part(o, uh, CURLUPART_OPTIONS);
     }
 
-    query_is_modified |= extractqpairs(uh, o);
-
-    /* trim parts */
-    query_is_modified |= trim(o);
-
-    /* replace parts */
-    query_is_modified |= replace(o);
-
     if(first_lap) {
-      /* append query segments */
-      for(p = o->append_query; p; p = p->next) {
-        addqpair(p->data, strlen(p->data), o->jsonout);
-        query_is_modified = true;
-      }
+      static const CURLUPart normparts[] = {
+        CURLUPART_FRAGMENT, CURLUPART_USER, CURLUPART_PASSWORD,
+        CURLUPART_OPTIONS
+      };
+      size_t i;
+      for(i = 0; i < sizeof(normparts)/sizeof(normparts[0]); i++)
+        if(NEEDPART(o, normparts[i]))
+          normalize_part(o, uh, normparts[i]);
     }
 
-    /* sort query */
-    query_is_modified |= sortquery(o);
+    if(NEEDPART(o, CURLUPART_QUERY)) {
+      query_is_modified |= extractqpairs(uh, o);
+
+      /* trim parts */
+      query_is_modified |= trim(o, o->trim_list);
+      for(r = 0; r < NMATCHED(o); r++)
+        query_is_modified |= trim(o, MATCHED(o, r)->trim_list);
+
+      /* replace parts */
+      query_is_modified |= replace(o, o->replace_list,
+                                   o->force_replace);
+      for(r = 0; r < NMATCHED(o); r++)
+        query_is_modified |= replace(o, MATCHED(o, r)->replace_list,
+                                     MATCHED(o, r)->force_replace);
+
+      if(first_lap) {
+        /* append query segments */
+        for(p = o->append_query; p; p = p->next) {
+          addqpair(o, p->data, strlen(p->data));
+          query_is_modified = true;
+        }
+        for(r = 0; r < NMATCHED(o); r++) {
+          for(p = MATCHED(o, r)->append_query; p; p = p->next) {
+            addqpair(o, p->data, strlen(p->data));
+            query_is_modified = true;
+          }
+        }
+      }
+
+      /* sort query */
+      query_is_modified |= sortquery(o);
 
-    /* put the query back */
-    if(query_is_modified)
-      qpair2query(uh, o);
+      /* put the query back */
+      if(query_is_modified)
+        qpair2query(uh, o);
+    }
 
     /* make sure the URL is still valid */
-    if(!url || o->redirect || o->set_list || o->append_path) {
+    if(!url || o->redirect || o->set_list || o->append_path ||
+       NMATCHED(o)) {
       char *ourl = NULL;
       CURLUcode rc = curl_url_get(uh, CURLUPART_URL, &ourl, 0);
       if(rc) {
-        if(o->verify) /* only clean up if we're exiting */
-          curl_url_cleanup(uh);
         verify(o, ERROR_URL, "not enough input for a URL");
         url_is_invalid = true;
       }
       else {
         rc = seturl(o, uh, ourl);
         if(rc) {
-          if(o->verify) /* only clean up if we're exiting */
-            curl_url_cleanup(uh);
           verify(o, ERROR_BADURL, "%s [%s]", curl_url_strerror(rc),
                  ourl);
           url_is_invalid = true;
@@ -1975,8 +4545,6 @@ static void singleurl(struct option *o,
           if(!rc)
             curl_free(nurl);
           else {
-            if(o->verify) /* only clean up if we're exiting */
-              curl_url_cleanup(uh);
             verify(o, ERROR_BADURL, "url became invalid");
             url_is_invalid = true;
           }
@@ -1993,6 +4561,8 @@ static void singleurl(struct option *o,
       json(o, uh);
     else if(o->format) {
       /* custom output format */
+      if(o->row && o->row->keep)
+        rowout(o, true);
       get(o, uh);
     }
     else {
@@ -2000,38 +4570,4570 @@ static void singleurl(struct option *o,
       char *nurl = NULL;
       int rc = geturlpart(o, 0, uh, CURLUPART_URL, &nurl);
       if(!rc) {
-        printf("%s\n", nurl);
+        if(o->row && o->row->keep) {
+          rowout(o, true);
+          rowvalue(o, nurl);
+          rowout(o, false);
+        }
+        else
+          fputs(nurl, o->out);
+        fputc(o->delim, o->out);
         curl_free(nurl);
       }
     }
 
-    fflush(stdout);
+    if(o->out == stdout)
+      fflush(stdout);
 
-    freeqpairs();
+    freeqpairs(o);
 
     o->urls++;
 
     first_lap = false;
   } while(iinfo->ptr);
-  if(!iinfo->uh)
+  if(!iinfo->uh) {
     curl_url_cleanup(uh);
+    o->uh = NULL;
+  }
 }
 
-int main(int argc, const char **argv)
-{
-  int exit_status = 0;
-  struct option o;
-  struct curl_slist *node;
-  memset(&o, 0, sizeof(o));
-  setlocale(LC_ALL, "");
-  curl_global_init(CURL_GLOBAL_ALL);
+/*
+ * Batch processing of URL files.
+ *
+ * Lines are read in groups of up to BATCH_LINES into a single buffer and
+ * then processed stage by stage over the whole group, with the per-line
+ * state kept in arrays: first a byte-class scan of every line, then a split
+ * of the simple ones into component spans, then the output in input order.
+ * Simple URLs are output directly from their spans, all others go through
+ * singleurl().
+ */
 
-  for(argc--, argv++; argc > 0; argc--, argv++) {
-    bool usedarg = false;
-    if(!o.end_of_options && argv[0][0] == '-') {
-      /* dash-dash prefixed */
-      if(getarg(&o, argv[0], argv[1], &usedarg)) {
-        /* if the long option ends with an equals sign, cut it there,
+#define BATCH_LINES 256
+
+struct batch {
+  char *buf; /* BATCH_LINES * MAX_LINE bytes */
+  int lines;
+  size_t off[BATCH_LINES];  /* where each line starts in 'buf' */
+  uint16_t len[BATCH_LINES];
+  unsigned char cls[BATCH_LINES]; /* all byte classes used in the line */
+  bool simple[BATCH_LINES];
+  struct urlspans spans[BATCH_LINES];
+};
+
+/* process the URL in a --input-format row */
+static void rowrun(struct option *o, const char *line, size_t len)
+{
+  struct row *r = o->row;
+  unsigned int urls = o->urls;
+  struct iterinfo iinfo;
+  if(o->input == INPUT_JSON) {
+    jsonrow(o, r, line, len);
+    if(!r->url)
+      verify(o, ERROR_BADURL, "no string field %s [%.*s]", o->json_field,
+             (int)len, line);
+  }
+  else if(o->input >= INPUT_COMBINED) {
+    logrow(o, r, line, len);
+    if(!r->url && !r->skip)
+      verify(o, ERROR_BADURL, "no URL in log line [%.*s]", (int)len, line);
+  }
+  else
+    rowsplit(o, r, line, len);
+  if(r->url) {
+    memset(&iinfo, 0, sizeof(iinfo));
+    singleurl(o, r->url, &iinfo, o->iter_list);
+  }
+  if(r->keep && (o->urls == urls)) {
+    /* no URL came out of it, keep the row as it was */
+    fwrite(line, 1, len, o->out);
+    if(o->format)
+      fputc(r->sep, o->out);
+    fputc(o->delim, o->out);
+  }
+}
+
+#ifndef TRURL_LIBRARY /* the library works on one URL at a time */
+/* process all lines in the batch, in order */
+static void batchrun(struct option *o, struct batch *b)
+{
+  int i;
+  if(o->fastpath) {
+    for(i = 0; i < b->lines; i++)
+      b->cls[i] = urlclass(&b->buf[b->off[i]], b->len[i]);
+    for(i = 0; i < b->lines; i++)
+      b->simple[i] = simplesplit(o, &b->buf[b->off[i]], b->len[i],
+                                 b->cls[i], &b->spans[i]);
+  }
+  else
+    memset(b->simple, 0, sizeof(b->simple));
+
+  for(i = 0; i < b->lines; i++) {
+    if(b->simple[i]) {
+      simpleget(o, &b->buf[b->off[i]], b->len[i], &b->spans[i]);
+      o->urls++;
+    }
+    else if(o->row)
+      rowrun(o, &b->buf[b->off[i]], b->len[i]);
+    else {
+      struct iterinfo iinfo;
+      memset(&iinfo, 0, sizeof(iinfo));
+      singleurl(o, &b->buf[b->off[i]], &iinfo, o->iter_list);
+    }
+  }
+  fflush(o->out);
+  b->lines = 0;
+}
+
+/*
+ * The --url-file is read through a buffer of its own, which is filled
+ * either straight from the file or from a decompressor when the file starts
+ * with the magic bytes of gzip, bzip2 or zstd.
+ */
+
+#define READBUF (64*1024)
+
+enum {
+  ENC_NONE,
+  ENC_GZIP,
+  ENC_BZIP2,
+  ENC_ZSTD
+};
+
+struct urlreader {
+  char *buf;      /* decoded input */
+  size_t start;   /* first unused byte */
+  size_t end;     /* end of the decoded input */
+  unsigned long long base; /* the input offset of buf[0] */
+  struct infile *src; /* read by a reader thread, or NULL */
+  struct uringin *uring; /* read with --io-uring, or NULL */
+  bool block;     /* fill with full blocks, not line by line */
+  bool direct;    /* read() what there is, for the --pipeline reader */
+  bool rawend;    /* end of the file reached */
+  bool eof;       /* no more input */
+  int enc;
+  unsigned char *in; /* compressed input */
+  size_t inlen;
+  size_t inpos;
+  bool streamend; /* the compressed stream ended */
+#ifdef HAVE_ZLIB_H
+  z_stream z;
+#endif
+#ifdef HAVE_BZLIB_H
+  bz_stream bz;
+#endif
+#ifdef HAVE_ZSTD_H
+  ZSTD_DStream *zs;
+#endif
+};
+
+/*
+ * With more than one --url-file, reader threads open and read the files
+ * ahead of the processing, into a small queue of blocks per file. The files
+ * are then processed one at a time, each through a reader of its own, in
+ * the order given with --keep-file-order and otherwise in the order their
+ * data shows up. The readers are joined once all files are processed; an
+ * error exit ends them with the process, as they may be blocked reading.
+ */
+
+#define MAX_READERS 4 /* threads reading --url-files */
+#define INBLOCK (256*1024)
+#define INQUEUE 4 /* blocks read ahead per file */
+
+struct inblock {
+  struct inblock *next;
+  size_t len;
+  char *data;
+};
+
+struct infile {
+  const char *name;
+  struct inputs *inputs;
+  struct inblock *head; /* blocks read */
+  struct inblock *tail;
+  size_t headoff;       /* the part of the head block already used */
+  int queued;
+  bool started;         /* opened by a reader */
+  bool done;            /* all blocks are read */
+  bool taken;           /* processed or being processed */
+  int err;              /* errno from opening or reading */
+};
+
+#ifdef HAVE_PTHREAD_H
+struct inputs {
+  struct infile *files;
+  int nfiles;
+  int next; /* the next file for a reader to open */
+  pthread_mutex_t lock;
+  pthread_cond_t cond; /* signalled on every change */
+  pthread_t threads[MAX_READERS];
+  int nthreads;
+};
+
+static void *inputthread(void *arg)
+{
+  struct inputs *in = arg;
+  pthread_mutex_lock(&in->lock);
+  while(in->next < in->nfiles) {
+    struct infile *f = &in->files[in->next++];
+    FILE *fp;
+    int err = 0;
+    f->started = true;
+    pthread_mutex_unlock(&in->lock);
+
+    fp = strcmp(f->name, "-") ? fopen(f->name, "rb") : stdin;
+    if(!fp)
+      err = errno;
+    while(fp) {
+      struct inblock *b = malloc(sizeof(struct inblock) + INBLOCK);
+      if(!b) {
+        err = ENOMEM;
+        break;
+      }
+      b->next = NULL;
+      b->data = (char *)&b[1];
+      b->len = fread(b->data, 1, INBLOCK, fp);
+      if(!b->len) {
+        if(ferror(fp))
+          err = errno;
+        free(b);
+        break;
+      }
+      pthread_mutex_lock(&in->lock);
+      while(f->queued >= INQUEUE)
+        pthread_cond_wait(&in->cond, &in->lock);
+      if(f->tail)
+        f->tail->next = b;
+      else
+        f->head = b;
+      f->tail = b;
+      f->queued++;
+      pthread_cond_broadcast(&in->cond);
+      pthread_mutex_unlock(&in->lock);
+    }
+    if(fp && (fp != stdin))
+      fclose(fp);
+
+    pthread_mutex_lock(&in->lock);
+    f->err = err;
+    f->done = true;
+    pthread_cond_broadcast(&in->cond);
+  }
+  pthread_mutex_unlock(&in->lock);
+  return NULL;
+}
+
+/* read from the blocks of a file, returns 0 at the end of it */
+static size_t inputread(struct option *o, struct infile *f, char *buf,
+                        size_t size)
+{
+  struct inputs *in = f->inputs;
+  size_t n = 0;
+  pthread_mutex_lock(&in->lock);
+  while(!f->head && !f->done)
+    pthread_cond_wait(&in->cond, &in->lock);
+  if(f->head) {
+    struct inblock *b = f->head;
+    n = b->len - f->headoff;
+    if(n > size)
+      n = size;
+    memcpy(buf, &b->data[f->headoff], n);
+    f->headoff += n;
+    if(f->headoff == b->len) {
+      f->head = b->next;
+      if(!f->head)
+        f->tail = NULL;
+      f->headoff = 0;
+      f->queued--;
+      free(b);
+      pthread_cond_broadcast(&in->cond);
+    }
+  }
+  pthread_mutex_unlock(&in->lock);
+  if(!n && f->err)
+    trurl_warnf(o, "--url-file %s: %s", f->name, strerror(f->err));
+  return n;
+}
+#endif
+
+#ifdef SUPPORTS_IO_URING
+/*
+ * --io-uring reads regular --url-files and writes the --output file with
+ * io_uring. Several large reads are kept in flight ahead of the processing,
+ * and output blocks are written while the next ones are formatted. The
+ * rings are set up with the plain system calls, so there is no library to
+ * depend on. When io_uring cannot be set up or cannot read and write, because
+ * the kernel is too old or it is disabled, trurl silently uses the normal
+ * reads and writes.
+ */
+#define URING_BLOCKS 4 /* reads or writes in flight */
+#define URING_BLOCK (1024*1024)
+
+#define URING_IDLE 0
+#define URING_BUSY 1 /* submitted */
+#define URING_DONE 2 /* completed */
+
+struct uring {
+  int fd;
+  unsigned *sqtail;
+  unsigned *sqmask;
+  unsigned *sqarray;
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned *cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sqmap;
+  void *cqmap;
+  size_t sqlen;
+  size_t cqlen;
+  size_t sqeslen;
+};
+
+static void uringfree(struct uring *u)
+{
+  if(u->sqes && (u->sqes != MAP_FAILED))
+    munmap(u->sqes, u->sqeslen);
+  if(u->cqmap && (u->cqmap != MAP_FAILED))
+    munmap(u->cqmap, u->cqlen);
+  if(u->sqmap && (u->sqmap != MAP_FAILED))
+    munmap(u->sqmap, u->sqlen);
+  if(u->fd >= 0)
+    close(u->fd);
+}
+
+static void *uringmap(struct uring *u, size_t len, off_t what)
+{
+  return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              u->fd, what);
+}
+
+/* can the ring do reads and writes? Linux 5.1 has io_uring but only got
+   these operations and the probe in 5.6 */
+static bool uringprobe(struct uring *u)
+{
+  unsigned nops = IORING_OP_WRITE + 1;
+  struct io_uring_probe *p =
+    calloc(1, sizeof(*p) + nops * sizeof(struct io_uring_probe_op));
+  bool ok;
+  if(!p)
+    return false;
+  ok = !syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE, p,
+                nops) &&
+    (p->ops_len > IORING_OP_WRITE) &&
+    (p->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+    (p->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+  free(p);
+  return ok;
+}
+
+static bool uringinit(struct uring *u)
+{
+  struct io_uring_params p;
+  char *sq;
+  char *cq;
+  memset(&p, 0, sizeof(p));
+  memset(u, 0, sizeof(*u));
+  u->fd = (int)syscall(__NR_io_uring_setup, URING_BLOCKS, &p);
+  if(u->fd < 0)
+    return false;
+  if(!uringprobe(u)) {
+    uringfree(u);
+    return false;
+  }
+  u->sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  u->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqmap = uringmap(u, u->sqlen, IORING_OFF_SQ_RING);
+  u->cqmap = uringmap(u, u->cqlen, IORING_OFF_CQ_RING);
+  u->sqes = uringmap(u, u->sqeslen, IORING_OFF_SQES);
+  if((u->sqmap == MAP_FAILED) || (u->cqmap == MAP_FAILED) ||
+     (u->sqes == MAP_FAILED)) {
+    uringfree(u);
+    return false;
+  }
+  sq = u->sqmap;
+  cq = u->cqmap;
+  u->sqtail = (unsigned *)(sq + p.sq_off.tail);
+  u->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sqarray = (unsigned *)(sq + p.sq_off.array);
+  u->cqhead = (unsigned *)(cq + p.cq_off.head);
+  u->cqtail = (unsigned *)(cq + p.cq_off.tail);
+  u->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return true;
+}
+
+/* queue a read or write, it is submitted with the next uringenter() */
+static void uringprep(struct uring *u, unsigned char op, int fd, char *buf,
+                      size_t len, unsigned long long off, int block)
+{
+  unsigned tail = *u->sqtail;
+  unsigned i = tail & *u->sqmask;
+  struct io_uring_sqe *sqe = &u->sqes[i];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long long)(uintptr_t)buf;
+  sqe->len = (unsigned)len;
+  sqe->off = off;
+  sqe->user_data = (unsigned long long)block;
+  u->sqarray[i] = i;
+  __atomic_store_n(u->sqtail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* submit 'submit' queued operations and wait for 'wait' to complete */
+static int uringenter(struct uring *u, unsigned submit, unsigned wait)
+{
+  for(;;) {
+    long rc = syscall(__NR_io_uring_enter, u->fd, submit, wait,
+                      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if((rc >= 0) || (errno != EINTR))
+      return (int)rc;
+  }
+}
+
+/* get a completion if there is one */
+static bool uringreap(struct uring *u, int *block, int *res)
+{
+  unsigned head = *u->cqhead;
+  struct io_uring_cqe *cqe;
+  if(head == __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE))
+    return false;
+  cqe = &u->cqes[head & *u->cqmask];
+  *block = (int)cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(u->cqhead, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/* wait for one completion, returns false if waiting failed */
+static bool uringwait(struct uring *u, int *state, int *res)
+{
+  int block;
+  int r;
+  while(!uringreap(u, &block, &r))
+    if(uringenter(u, 0, 1) < 0)
+      return false;
+  state[block] = URING_DONE;
+  res[block] = r;
+  return true;
+}
+
+/* the blocks of a --url-file, read in order, URING_BLOCKS ahead */
+struct uringin {
+  struct uring u;
+  int fd;
+  char *data;
+  int state[URING_BLOCKS];
+  int res[URING_BLOCKS];  /* bytes read or -errno */
+  int head;               /* the block to use next */
+  size_t headoff;         /* the part of it already used */
+  unsigned long long next; /* the file offset of the next read */
+  bool end;               /* nothing more to read */
+  int err;                /* errno if submitting failed */
+};
+
+/* start reads into the idle blocks, they follow the busy ones */
+static void uringinsubmit(struct uringin *ui)
+{
+  int sub[URING_BLOCKS];
+  unsigned n = 0;
+  int k;
+  for(k = 0; k < URING_BLOCKS; k++) {
+    int i = (ui->head + k) % URING_BLOCKS;
+    if(ui->state[i] == URING_IDLE) {
+      uringprep(&ui->u, IORING_OP_READ, ui->fd,
+                &ui->data[(size_t)i * URING_BLOCK], URING_BLOCK, ui->next, i);
+      ui->state[i] = URING_BUSY;
+      ui->next += URING_BLOCK;
+      sub[n++] = i;
+    }
+  }
+  if(n && (uringenter(&ui->u, n, 0) < 0)) {
+    /* none of them are in flight */
+    ui->err = errno;
+    while(n)
+      ui->state[sub[--n]] = URING_IDLE;
+  }
+}
+
+/* wait for the reads in flight, the kernel writes to the blocks */
+static void uringindrain(struct uringin *ui)
+{
+  int i;
+  for(i = 0; i < URING_BLOCKS; i++)
+    while(ui->state[i] == URING_BUSY)
+      if(!uringwait(&ui->u, ui->state, ui->res))
+        return;
+}
+
+/* read the file that 'fp' has open with io_uring from where it is, returns
+   NULL if it cannot be done */
+static struct uringin *uringinopen(FILE *fp)
+{
+  struct uringin *ui;
+  off_t pos = ftello(fp);
+  if(pos < 0)
+    return NULL;
+  ui = calloc(1, sizeof(struct uringin));
+  if(!ui)
+    return NULL;
+  ui->data = malloc((size_t)URING_BLOCKS * URING_BLOCK);
+  if(!ui->data || !uringinit(&ui->u)) {
+    free(ui->data);
+    free(ui);
+    return NULL;
+  }
+  ui->fd = fileno(fp);
+  ui->next = (unsigned long long)pos;
+  uringinsubmit(ui);
+  return ui;
+}
+
+static void uringinclose(struct uringin *ui)
+{
+  uringindrain(ui);
+  uringfree(&ui->u);
+  free(ui->data);
+  free(ui);
+}
+
+/* continue reading at file offset 'pos' */
+static void uringinseek(struct uringin *ui, unsigned long long pos)
+{
+  int i;
+  uringindrain(ui);
+  for(i = 0; i < URING_BLOCKS; i++)
+    ui->state[i] = URING_IDLE;
+  ui->head = 0;
+  ui->headoff = 0;
+  ui->next = pos;
+  ui->end = false;
+  ui->err = 0;
+  uringinsubmit(ui);
+}
+
+/* copy read data in order, returns 0 at the end of the file */
+static size_t uringread(struct option *o, struct uringin *ui, char *buf,
+                        size_t size)
+{
+  int i = ui->head;
+  size_t n;
+  if(ui->end)
+    return 0;
+  if(ui->state[i] == URING_IDLE) {
+    trurl_warnf(o, "read: %s", strerror(ui->err));
+    ui->end = true;
+    return 0;
+  }
+  while(ui->state[i] == URING_BUSY)
+    if(!uringwait(&ui->u, ui->state, ui->res)) {
+      trurl_warnf(o, "read: %s", strerror(errno));
+      ui->end = true;
+      return 0;
+    }
+  if(ui->res[i] <= 0) {
+    if(ui->res[i] < 0)
+      trurl_warnf(o, "read: %s", strerror(-ui->res[i]));
+    ui->end = true;
+    return 0;
+  }
+  n = (size_t)ui->res[i] - ui->headoff;
+  if(n > size)
+    n = size;
+  memcpy(buf, &ui->data[(size_t)i * URING_BLOCK + ui->headoff], n);
+  ui->headoff += n;
+  if(ui->headoff == (size_t)ui->res[i]) {
+    /* a short read of a regular file is its end */
+    if(ui->res[i] < URING_BLOCK)
+      ui->end = true;
+    ui->state[i] = URING_IDLE;
+    ui->headoff = 0;
+    ui->head = (i + 1) % URING_BLOCKS;
+    if(!ui->end)
+      uringinsubmit(ui);
+  }
+  return n;
+}
+#endif /* SUPPORTS_IO_URING */
+
+/* read raw bytes from the file */
+static size_t rawread(struct option *o, struct urlreader *r,
+                      char *buf, size_t size)
+{
+  size_t n = 0;
+  if(r->rawend)
+    return 0;
+#ifdef HAVE_PTHREAD_H
+  if(r->src) {
+    n = inputread(o, r->src, buf, size);
+    if(!n)
+      r->rawend = true;
+    return n;
+  }
+#endif
+#ifdef SUPPORTS_IO_URING
+  if(r->uring) {
+    n = uringread(o, r->uring, buf, size);
+    if(!n)
+      r->rawend = true;
+    return n;
+  }
+#endif
+#ifdef SUPPORTS_PIPELINE
+  if(r->direct) {
+    ssize_t rc;
+    do
+      rc = read(fileno(o->url), buf, size);
+    while((rc < 0) && (errno == EINTR));
+    if(rc <= 0) {
+      if(rc < 0)
+        trurl_warnf(o, "read: %s", strerror(errno));
+      r->rawend = true;
+      return 0;
+    }
+    return (size_t)rc;
+  }
+#endif
+  if(r->block)
+    n = fread(buf, 1, size, o->url);
+  else {
+    /* one line at a time, the input might be interactive */
+    int ch;
+    while((n < size) && ((ch = getc(o->url)) != EOF)) {
+      buf[n++] = (char)ch;
+      if(ch == o->delim)
+        break;
+    }
+  }
+  if((n < size) && (feof(o->url) || ferror(o->url))) {
+    if(ferror(o->url))
+      trurl_warnf(o, "read: %s", strerror(errno));
+    r->rawend = true;
+  }
+  return n;
+}
+
+static const char *encname(int enc)
+{
+  switch(enc) {
+  case ENC_GZIP:
+    return "gzip";
+  case ENC_BZIP2:
+    return "bzip2";
+  default:
+    return "zstd";
+  }
+}
+
+static void decoderinit(struct option *o, struct urlreader *r)
+{
+  switch(r->enc) {
+#ifdef HAVE_ZLIB_H
+  case ENC_GZIP:
+    /* 16 + max window bits: gzip wrapper */
+    if(inflateInit2(&r->z, 16 + MAX_WBITS) != Z_OK)
+      errorf(o, ERROR_MEM, "out of memory");
+    return;
+#endif
+#ifdef HAVE_BZLIB_H
+  case ENC_BZIP2:
+    if(BZ2_bzDecompressInit(&r->bz, 0, 0) != BZ_OK)
+      errorf(o, ERROR_MEM, "out of memory");
+    return;
+#endif
+#ifdef HAVE_ZSTD_H
+  case ENC_ZSTD:
+    r->zs = ZSTD_createDStream();
+    if(!r->zs)
+      errorf(o, ERROR_MEM, "out of memory");
+    ZSTD_initDStream(r->zs);
+    return;
+#endif
+  default:
+    errorf(o, ERROR_FILE, "--url-file is %s compressed, which this trurl "
+           "does not support", encname(r->enc));
+  }
+}
+
+static void decoderfree(struct urlreader *r)
+{
+  switch(r->enc) {
+#ifdef HAVE_ZLIB_H
+  case ENC_GZIP:
+    inflateEnd(&r->z);
+    break;
+#endif
+#ifdef HAVE_BZLIB_H
+  case ENC_BZIP2:
+    BZ2_bzDecompressEnd(&r->bz);
+    break;
+#endif
+#ifdef HAVE_ZSTD_H
+  case ENC_ZSTD:
+    ZSTD_freeDStream(r->zs);
+    break;
+#endif
+  default:
+    break;
+  }
+}
+
+/* decompress into 'out', returns the number of bytes, 0 at the end */
+static size_t decode(struct option *o, struct urlreader *r,
+                     char *out, size_t size)
+{
+  size_t n = 0;
+  while(!n) {
+    bool more;
+    if(r->inpos == r->inlen) {
+      r->inlen = rawread(o, r, (char *)r->in, READBUF);
+      r->inpos = 0;
+    }
+    if(r->inpos == r->inlen) {
+      /* no more input */
+      if(!r->streamend)
+        trurl_warnf(o, "--url-file: truncated %s input", encname(r->enc));
+      return 0;
+    }
+    if(r->streamend) {
+      /* more data after the end of a stream: the next member */
+      decoderfree(r);
+      decoderinit(o, r);
+      r->streamend = false;
+    }
+    switch(r->enc) {
+#ifdef HAVE_ZLIB_H
+    case ENC_GZIP: {
+      int rc;
+      r->z.next_in = &r->in[r->inpos];
+      r->z.avail_in = (uInt)(r->inlen - r->inpos);
+      r->z.next_out = (Bytef *)out;
+      r->z.avail_out = (uInt)size;
+      rc = inflate(&r->z, Z_NO_FLUSH);
+      if((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR))
+        errorf(o, ERROR_FILE, "--url-file: bad gzip input");
+      r->inpos = r->inlen - r->z.avail_in;
+      n = size - r->z.avail_out;
+      more = (rc == Z_STREAM_END);
+      break;
+    }
+#endif
+#ifdef HAVE_BZLIB_H
+    case ENC_BZIP2: {
+      int rc;
+      r->bz.next_in = (char *)&r->in[r->inpos];
+      r->bz.avail_in = (unsigned int)(r->inlen - r->inpos);
+      r->bz.next_out = out;
+      r->bz.avail_out = (unsigned int)size;
+      rc = BZ2_bzDecompress(&r->bz);
+      if((rc != BZ_OK) && (rc != BZ_STREAM_END))
+        errorf(o, ERROR_FILE, "--url-file: bad bzip2 input");
+      r->inpos = r->inlen - r->bz.avail_in;
+      n = size - r->bz.avail_out;
+      more = (rc == BZ_STREAM_END);
+      break;
+    }
+#endif
+#ifdef HAVE_ZSTD_H
+    case ENC_ZSTD: {
+      ZSTD_inBuffer zin;
+      ZSTD_outBuffer zout;
+      size_t rc;
+      zin.src = &r->in[r->inpos];
+      zin.size = r->inlen - r->inpos;
+      zin.pos = 0;
+      zout.dst = out;
+      zout.size = size;
+      zout.pos = 0;
+      rc = ZSTD_decompressStream(r->zs, &zout, &zin);
+      if(ZSTD_isError(rc))
+        errorf(o, ERROR_FILE, "--url-file: bad zstd input: %s",
+               ZSTD_getErrorName(rc));
+      r->inpos += zin.pos;
+      n = zout.pos;
+      /* zstd continues with the next frame by itself */
+      more = (rc == 0);
+      break;
+    }
+#endif
+    default:
+      /* not reached, decoderinit() refuses unsupported encodings */
+      (void)out;
+      (void)size;
+      return 0;
+    }
+    r->streamend = more;
+  }
+  return n;
+}
+
+/* detect the encoding from the first bytes of the file */
+static void readerinit(struct option *o, struct urlreader *r)
+{
+  struct stat st;
+  const unsigned char *m;
+
+  r->buf = malloc(READBUF);
+  if(!r->buf)
+    errorf(o, ERROR_MEM, "out of memory");
+
+  /* only read ahead for regular files, other input might be interactive */
+  r->block = r->src ||
+    (!fstat(fileno(o->url), &st) && S_ISREG(st.st_mode));
+#ifdef SUPPORTS_IO_URING
+  if(o->io_uring && r->block && !r->src && !o->follow)
+    r->uring = uringinopen(o->url);
+#endif
+#ifdef SUPPORTS_PIPELINE
+  /* the reader thread waits for input anyway, take what there is */
+  r->direct = o->pipeline && !r->block;
+#endif
+  r->end = rawread(o, r, r->buf, 4);
+  if(!r->block && r->end && (r->buf[r->end - 1] != o->delim) && !r->rawend)
+    /* the rest of the first line */
+    r->end += rawread(o, r, &r->buf[r->end], READBUF - r->end);
+
+  m = (const unsigned char *)r->buf;
+  if((r->end >= 2) && (m[0] == 0x1f) && (m[1] == 0x8b))
+    r->enc = ENC_GZIP;
+  else if((r->end >= 4) && (m[0] == 'B') && (m[1] == 'Z') && (m[2] == 'h') &&
+          (m[3] >= '1') && (m[3] <= '9'))
+    r->enc = ENC_BZIP2;
+  else if((r->end >= 4) && (m[0] == 0x28) && (m[1] == 0xb5) &&
+          (m[2] == 0x2f) && (m[3] == 0xfd))
+    r->enc = ENC_ZSTD;
+
+  if(r->enc != ENC_NONE) {
+    /* what was read so far is compressed input */
+    r->in = malloc(READBUF);
+    if(!r->in)
+      errorf(o, ERROR_MEM, "out of memory");
+    memcpy(r->in, r->buf, r->end);
+    r->inlen = r->end;
+    r->end = 0;
+    /* compressed input is never interactive */
+    r->block = true;
+    decoderinit(o, r);
+  }
+}
+
+static void readerfree(struct urlreader *r)
+{
+#ifdef SUPPORTS_IO_URING
+  if(r->uring)
+    uringinclose(r->uring);
+#endif
+  if(r->enc != ENC_NONE)
+    decoderfree(r);
+  free(r->in);
+  free(r->buf);
+  free(r);
+}
+
+/* add more input to the buffer, returns false at the end */
+static bool readerfill(struct option *o, struct urlreader *r)
+{
+  size_t n;
+  if(r->eof)
+    return false;
+  if(r->start) {
+    memmove(r->buf, &r->buf[r->start], r->end - r->start);
+    r->base += r->start;
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if(r->enc == ENC_NONE)
+    n = rawread(o, r, &r->buf[r->end], READBUF - r->end);
+  else
+    n = decode(o, r, &r->buf[r->end], READBUF - r->end);
+  if(!n)
+    r->eof = true;
+  r->end += n;
+  return n > 0;
+}
+
+/* skip 'len' bytes of input, with a seek when possible */
+static void readerskip(struct option *o, struct urlreader *r,
+                       unsigned long long len)
+{
+  size_t avail = r->end - r->start;
+  if(len <= avail) {
+    r->start += (size_t)len;
+    return;
+  }
+  len -= avail;
+  r->start = r->end;
+#ifdef SUPPORTS_IO_URING
+  if((r->enc == ENC_NONE) && r->uring && (len > READBUF)) {
+    uringinseek(r->uring, r->base + r->end + len);
+    r->base += r->end + len;
+    r->start = r->end = 0;
+    return;
+  }
+#endif
+  if((r->enc == ENC_NONE) && r->block && !r->src && (len > READBUF) &&
+     !fseeko(o->url, (off_t)len, SEEK_CUR)) {
+    r->base += r->end + len;
+    r->start = r->end = 0;
+    return;
+  }
+  while(len && readerfill(o, r)) {
+    avail = r->end - r->start;
+    if(len < avail) {
+      r->start += (size_t)len;
+      break;
+    }
+    len -= avail;
+    r->start = r->end;
+  }
+}
+
+/* skip to the start of the next record */
+static void readeralign(struct option *o, struct urlreader *r)
+{
+  for(;;) {
+    char *d = memchr(&r->buf[r->start], o->delim, r->end - r->start);
+    if(d) {
+      r->start = d - r->buf + 1;
+      return;
+    }
+    r->start = r->end;
+    if(!readerfill(o, r))
+      return;
+  }
+}
+
+/* make sure 'len' bytes are in the buffer, returns false if there are
+   not that many left */
+static bool readerneed(struct option *o, struct urlreader *r, size_t len)
+{
+  while((r->end - r->start) < len)
+    if(!readerfill(o, r))
+      return false;
+  return true;
+}
+
+/* read the next URL from the file into 'buffer', return its length or -1
+   when there are no more */
+static int readurl(struct option *o, char *buffer, int size)
+{
+  struct urlreader *r = o->reader;
+  size_t max = (size_t)size - 1;
+  for(;;) {
+    char *line = &r->buf[r->start];
+    size_t avail;
+    char *eol;
+    size_t next;
+    size_t len;
+
+    if(o->ranged && o->range_end &&
+       ((r->base + r->start) >= o->range_end))
+      /* the rest is for another part */
+      return -1;
+    avail = r->end - r->start;
+    eol = memchr(line, o->delim, avail < max ? avail : max);
+
+    if(!eol && (avail < max) && readerfill(o, r))
+      continue;
+
+    if(eol)
+      next = r->start + (eol - line) + 1;
+    else if(avail < max) {
+      /* end of file */
+      if(!avail || o->follow)
+        /* with --follow, an unterminated last line might still be growing
+           and is left for later */
+        return -1;
+      eol = &line[avail];
+      next = r->end;
+    }
+    else {
+      /* line too long */
+      trurl_warnf(o, "skipping long line");
+      do {
+        eol = memchr(&r->buf[r->start], o->delim, r->end - r->start);
+        if(eol) {
+          r->start = eol - r->buf + 1;
+          break;
+        }
+        r->start = r->end;
+      } while(readerfill(o, r));
+      continue;
+    }
+    r->start = next;
+
+    if(o->delim == '\n') {
+      if((eol > line) && (eol[-1] == '\r'))
+        /* CRLF detected */
+        eol--;
+
+      /* trim trailing spaces and tabs */
+      while((eol > line) &&
+            ((eol[-1] == ' ') || eol[-1] == '\t'))
+        eol--;
+    }
+
+    len = eol - line;
+    if(len) {
+      /* if there is actual content left to deal with */
+      memcpy(buffer, line, len);
+      buffer[len] = 0; /* end of URL */
+      return (int)len;
+    }
+  }
+}
+
+#endif /* !TRURL_LIBRARY */
+
+/*
+ * --extract finds URLs in free text. The text is searched for "://" and
+ * "www." with memchr() and memmem(), each hit is widened to the URL around
+ * it and the candidate is only used if it parses as a URL.
+ */
+
+#define MAX_SCHEME 32 /* longest scheme looked for before "://" */
+
+#ifdef _MSC_VER
+/* memmem() replacement, also used by --html and for pcap input */
+static void *memmem(const void *haystack, size_t hlen, const void *needle,
+                    size_t nlen)
+{
+  const char *h = haystack;
+  const char *end = &h[hlen];
+  if(!nlen)
+    return (void *)h;
+  while((size_t)(end - h) >= nlen) {
+    h = memchr(h, *(const char *)needle, (size_t)(end - h) - nlen + 1);
+    if(!h)
+      break;
+    if(!memcmp(h, needle, nlen))
+      return (void *)h;
+    h++;
+  }
+  return NULL;
+}
+#endif
+
+/* the bytes that can be part of a URL in text */
+static bool urlbyte(unsigned char c)
+{
+  if(c >= 0x80)
+    /* UTF-8 */
+    return true;
+  if((c <= ' ') || (c == 0x7f))
+    return false;
+  return !strchr("<>\"'`{}|\\^", c);
+}
+
+static bool schemebyte(char c)
+{
+  return ISALNUM(c) || (c == '+') || (c == '-') || (c == '.');
+}
+
+/* cut off closing brackets without an opening one in the URL */
+static size_t extractclose(const char *text, size_t len, char open,
+                           char close)
+{
+  size_t i;
+  size_t opened = 0;
+  size_t closed = 0;
+  for(i = 0; i < len; i++) {
+    if(text[i] == open)
+      opened++;
+    else if(text[i] == close)
+      closed++;
+  }
+  while(len && (closed > opened) && (text[len - 1] == close)) {
+    len--;
+    closed--;
+  }
+  return len;
+}
+
+/* handle one URL candidate */
+static void extractone(struct option *o, const char *text, size_t len)
+{
+  char url[MAX_LINE];
+  struct urlspans sp;
+  struct iterinfo iinfo;
+
+  /* punctuation after a URL is most likely not part of it */
+  while(len && strchr(".,;:!?*", text[len - 1]))
+    len--;
+  len = extractclose(text, len, '(', ')');
+  len = extractclose(text, len, '[', ']');
+  if(!len || (len >= sizeof(url)))
+    return;
+  memcpy(url, text, len);
+  url[len] = 0;
+
+  if(o->fastpath &&
+     simplesplit(o, url, len, urlclass(url, len), &sp)) {
+    /* no rewriting needed */
+    simpleget(o, url, len, &sp);
+    o->urls++;
+    return;
+  }
+  if(seturl(o, o->extractuh, url))
+    /* not a URL after all, this is not worth a warning */
+    return;
+  memset(&iinfo, 0, sizeof(iinfo));
+  singleurl(o, url, &iinfo, o->iter_list);
+}
+
+/*
+ * Find the URLs in 'text', looking for markers from offset 'from'. Returns
+ * how much of the text is done with. Unless 'final' is set, a URL that
+ * might continue after the text is left for the next call and '*from' is
+ * set to where to look for markers then.
+ */
+static size_t extracttext(struct option *o, const char *text, size_t len,
+                          size_t *from, bool final)
+{
+  const char *end = &text[len];
+  const char *done = text; /* the end of the previous URL */
+  const char *p = &text[*from];
+  const char *colon = NULL;
+  const char *www = NULL;
+  size_t keep;
+
+  for(;;) {
+    const char *start;
+    const char *stop;
+
+    if(!colon || (colon < p))
+      colon = memchr(p, ':', end - p);
+    if(!www || (www < p))
+      www = memmem(p, end - p, "www.", 4);
+    if(!colon && !www)
+      break;
+
+    if(colon && (!www || (colon < www))) {
+      p = colon + 1;
+      if((end - colon) < 3) {
+        if(final)
+          continue;
+        break;
+      }
+      if((colon[1] != '/') || (colon[2] != '/'))
+        continue;
+      /* the scheme must start with a letter */
+      for(start = colon; (start > done) && ((colon - start) < MAX_SCHEME) &&
+            schemebyte(start[-1]); start--)
+        ;
+      while((start < colon) && !ISALNUM(*start))
+        start++;
+      if((start == colon) || ISDIGIT(*start))
+        continue;
+      stop = colon + 3;
+    }
+    else {
+      p = www + 4;
+      if((www > done) && (ISALNUM(www[-1]) || strchr("./@-_~:", www[-1])))
+        /* part of something else */
+        continue;
+      start = www;
+      stop = p;
+    }
+
+    while((stop < end) && urlbyte((unsigned char)*stop))
+      stop++;
+    if((stop == end) && !final) {
+      /* it might continue */
+      *from = 0;
+      return start - text;
+    }
+    extractone(o, start, stop - start);
+    done = p = stop;
+  }
+  if(final)
+    return len;
+  /* keep enough for a scheme and marker that continue in the next text,
+     the markers in it have been looked at already */
+  keep = end - done;
+  if(keep > MAX_SCHEME + 3)
+    keep = MAX_SCHEME + 3;
+  *from = keep > 3 ? keep - 3 : 0;
+  return len - keep;
+}
+
+#ifndef TRURL_LIBRARY
+/* find the URLs in the --url-file */
+static void extractrun(struct option *o)
+{
+  struct urlreader *r = o->reader;
+  size_t from = 0;
+  bool skip = false; /* inside a too long URL */
+  bool more;
+  do {
+    more = readerfill(o, r);
+    if(skip) {
+      while((r->start < r->end) && urlbyte((unsigned char)r->buf[r->start]))
+        r->start++;
+      if(r->start == r->end)
+        continue;
+      skip = false;
+      from = 0;
+    }
+    r->start += extracttext(o, &r->buf[r->start], r->end - r->start, &from,
+                            !more);
+    if((r->end - r->start) >= MAX_LINE) {
+      /* longer than a URL can be, skip the rest of it */
+      r->start = r->end;
+      skip = true;
+    }
+  } while(more);
+  fflush(o->out);
+}
+
+/*
+ * --html finds the links in an HTML document: the values of href, src and
+ * action attributes. A small tokenizer walks the tags in the read buffer,
+ * skipping comments and the contents of script and style elements. Links
+ * are resolved against the first <base href> or the --base URL.
+ */
+
+#define HTML_TEXT 0
+#define HTML_COMMENT 1
+#define HTML_RAW 2 /* inside script or style */
+
+#define HTML_ATTRS 8 /* links kept per tag */
+
+#define ISHTMLSPACE(x) (((x) == ' ') || ((x) == '\t') || ((x) == '\n') || \
+                        ((x) == '\r') || ((x) == '\f'))
+
+struct htmlparse {
+  int state;
+  const char *rawtag; /* "script" or "style" */
+  bool based; /* a <base href> has been seen */
+};
+
+/* case insensitive compare of a tag or attribute name */
+static bool htmlname(const char *s, size_t len, const char *name)
+{
+  size_t i;
+  for(i = 0; i < len; i++)
+    if(!name[i] || ((s[i] | 0x20) != name[i]))
+      return false;
+  return !name[i];
+}
+
+/* decode the character references, skip tabs and newlines and trim the
+   spaces, returns the length or 0 if it does not fit */
+static size_t htmldecode(const char *val, size_t vlen, char *out,
+                         size_t size)
+{
+  const char *end = &val[vlen];
+  size_t len = 0;
+  while((val < end) && ISHTMLSPACE(*val))
+    val++;
+  while((end > val) && ISHTMLSPACE(end[-1]))
+    end--;
+  while(val < end) {
+    char c = *val++;
+    if((c == '\t') || (c == '\n') || (c == '\r'))
+      continue;
+    if(len + 4 >= size)
+      return 0;
+    if(c == '&') {
+      const char *semi = memchr(val, ';', end - val);
+      size_t nlen = semi ? (size_t)(semi - val) : 0;
+      if((nlen > 1) && (*val == '#')) {
+        char *numend;
+        unsigned long cp = (val[1] == 'x' || val[1] == 'X') ?
+          strtoul(&val[2], &numend, 16) : strtoul(&val[1], &numend, 10);
+        if((numend == semi) && cp && (cp < 0x110000)) {
+          len += utf8_encode((uint32_t)cp, &out[len], size - len);
+          val = semi + 1;
+          continue;
+        }
+      }
+      else if(htmlname(val, nlen, "amp"))
+        c = '&';
+      else if(htmlname(val, nlen, "lt"))
+        c = '<';
+      else if(htmlname(val, nlen, "gt"))
+        c = '>';
+      else if(htmlname(val, nlen, "quot"))
+        c = '"';
+      else if(htmlname(val, nlen, "apos"))
+        c = '\'';
+      else
+        nlen = 0;
+      if(nlen)
+        val = semi + 1;
+    }
+    out[len++] = c;
+  }
+  out[len] = 0;
+  return len;
+}
+
+/* the length of the scheme and colon the URL starts with, or 0 */
+static size_t urlscheme(const char *url)
+{
+  const char *p = url;
+  if(!ISALPHA(*p))
+    return 0;
+  while(ISALNUM(*p) || (*p == '+') || (*p == '-') || (*p == '.'))
+    p++;
+  return (*p == ':') ? (size_t)(p - url) + 1 : 0;
+}
+
+/* handle a link found in the document */
+static void htmllink(struct option *o, struct htmlparse *h, const char *val,
+                     size_t vlen, bool base)
+{
+  char url[MAX_LINE];
+  struct iterinfo iinfo;
+
+  size_t slen;
+
+  if(!htmldecode(val, vlen, url, sizeof(url)))
+    return;
+  slen = urlscheme(url);
+  if(slen && strncmp(&url[slen], "//", 2))
+    /* not a link to resolve, like mailto: */
+    return;
+
+  if(base) {
+    /* only the first <base href> is used */
+    CURLU *uh;
+    h->based = true;
+    if(!o->baseuh && !slen)
+      return;
+    uh = o->baseuh ? curl_url_dup(o->baseuh) : curl_url();
+    if(!uh)
+      errorf(o, ERROR_MEM, "out of memory");
+    if(seturl(o, uh, url)) {
+      curl_url_cleanup(uh);
+      verify(o, ERROR_BADURL, "invalid base: %s", url);
+      return;
+    }
+    o->htmlbaseuh = uh;
+    return;
+  }
+
+  if(!o->baseuh && !o->htmlbaseuh && !slen)
+    /* a relative link without a document URL to resolve it against */
+    return;
+  memset(&iinfo, 0, sizeof(iinfo));
+  singleurl(o, url, &iinfo, o->iter_list);
+}
+
+/* parse the tag at the start of 'tag', returns its length or 0 if it
+   continues after 'len' bytes */
+static size_t htmltag(struct option *o, struct htmlparse *h, const char *tag,
+                      size_t len)
+{
+  const char *end = &tag[len];
+  const char *p = &tag[1];
+  const char *name;
+  size_t nlen;
+  const char *links[HTML_ATTRS];
+  size_t linklen[HTML_ATTRS];
+  bool base[HTML_ATTRS];
+  int nlinks = 0;
+  int i;
+
+  if(p == end)
+    return 0;
+  if((*p == '!') || (*p == '?') || (*p == '/')) {
+    const char *gt;
+    if((end - p) < 3)
+      return 0;
+    if(!memcmp(p, "!--", 3)) {
+      h->state = HTML_COMMENT;
+      return 4;
+    }
+    gt = memchr(p, '>', end - p);
+    return gt ? (size_t)(gt - tag) + 1 : 0;
+  }
+  if(!ISALPHA(*p))
+    /* a lone '<' in the text */
+    return 1;
+
+  name = p;
+  while((p < end) && ISALNUM(*p))
+    p++;
+  nlen = p - name;
+
+  for(;;) {
+    const char *aname;
+    size_t alen;
+    while((p < end) && (ISHTMLSPACE(*p) || (*p == '/')))
+      p++;
+    if(p == end)
+      return 0;
+    if(*p == '>')
+      break;
+    aname = p;
+    while((p < end) && !ISHTMLSPACE(*p) && (*p != '=') && (*p != '>') &&
+          (*p != '/'))
+      p++;
+    alen = p - aname;
+    while((p < end) && ISHTMLSPACE(*p))
+      p++;
+    if(p == end)
+      return 0;
+    if(*p == '=') {
+      const char *val;
+      size_t vlen;
+      p++;
+      while((p < end) && ISHTMLSPACE(*p))
+        p++;
+      if(p == end)
+        return 0;
+      if((*p == '"') || (*p == '\'')) {
+        const char *q = memchr(&p[1], *p, end - p - 1);
+        if(!q)
+          return 0;
+        val = &p[1];
+        vlen = q - val;
+        p = q + 1;
+      }
+      else {
+        val = p;
+        while((p < end) && !ISHTMLSPACE(*p) && (*p != '>'))
+          p++;
+        if(p == end)
+          return 0;
+        vlen = p - val;
+      }
+      if(nlinks < HTML_ATTRS) {
+        bool isbase = htmlname(name, nlen, "base");
+        if(isbase ? (!h->based && htmlname(aname, alen, "href")) :
+           (htmlname(aname, alen, "href") || htmlname(aname, alen, "src") ||
+            htmlname(aname, alen, "action"))) {
+          links[nlinks] = val;
+          linklen[nlinks] = vlen;
+          base[nlinks++] = isbase;
+        }
+      }
+    }
+  }
+
+  /* the whole tag is there */
+  for(i = 0; i < nlinks; i++)
+    htmllink(o, h, links[i], linklen[i], base[i]);
+  if(htmlname(name, nlen, "script"))
+    h->rawtag = "script";
+  else if(htmlname(name, nlen, "style"))
+    h->rawtag = "style";
+  else
+    h->rawtag = NULL;
+  if(h->rawtag)
+    h->state = HTML_RAW;
+  return (p - tag) + 1;
+}
+
+/* find the links in 'text', returns how much of it is done with */
+static size_t htmltext(struct option *o, struct htmlparse *h,
+                       const char *text, size_t len, bool final)
+{
+  const char *end = &text[len];
+  const char *p = text;
+  while(p < end) {
+    const char *lt;
+    size_t n;
+    if(h->state == HTML_COMMENT) {
+      const char *e = memmem(p, end - p, "-->", 3);
+      if(!e) {
+        /* keep what might be the start of the end */
+        if(final || ((end - p) <= 2))
+          return final ? len : (size_t)(p - text);
+        return (end - 2) - text;
+      }
+      h->state = HTML_TEXT;
+      p = e + 3;
+      continue;
+    }
+    lt = memchr(p, '<', end - p);
+    if(!lt)
+      break;
+    if(h->state == HTML_RAW) {
+      size_t rlen = strlen(h->rawtag);
+      if((size_t)(end - lt) < rlen + 2)
+        return final ? len : (size_t)(lt - text);
+      p = lt + 1;
+      if((lt[1] == '/') && htmlname(&lt[2], rlen, h->rawtag))
+        /* the end tag */
+        h->state = HTML_TEXT;
+      else
+        continue;
+    }
+    n = htmltag(o, h, lt, end - lt);
+    if(!n)
+      return final ? len : (size_t)(lt - text);
+    p = lt + n;
+  }
+  return len;
+}
+
+/* find the links in the --html document */
+static void htmlrun(struct option *o)
+{
+  struct urlreader *r = o->reader;
+  struct htmlparse h;
+  bool more;
+  memset(&h, 0, sizeof(h));
+  do {
+    more = readerfill(o, r);
+    r->start += htmltext(o, &h, &r->buf[r->start], r->end - r->start, !more);
+    if((r->end - r->start) >= (READBUF / 2))
+      /* a tag too large to handle, treat its start as text */
+      r->start++;
+  } while(more);
+  fflush(o->out);
+}
+
+/*
+ * --input-format warc reads WARC records. Only the header block of each
+ * record is looked at, the body is skipped using its Content-Length, with a
+ * seek when the input is an uncompressed file.
+ */
+
+#define WARC_MAXHEAD (READBUF / 2)
+
+/* find the end of the header block, returns the length of it including
+   the empty line, or 0 */
+static size_t warchead(const char *p, size_t len)
+{
+  const char *end = &p[len];
+  const char *nl = p;
+  for(;;) {
+    nl = memchr(nl, '\n', end - nl);
+    if(!nl)
+      return 0;
+    nl++;
+    if((nl < end) && (*nl == '\n'))
+      return nl - p + 1;
+    if(((end - nl) > 1) && (nl[0] == '\r') && (nl[1] == '\n'))
+      return nl - p + 2;
+  }
+}
+
+/* handle all records in the --url-file */
+static void warcrun(struct option *o)
+{
+  struct urlreader *r = o->reader;
+  struct row *row = o->row;
+  bool more = readerfill(o, r);
+  for(;;) {
+    const char *p;
+    const char *end;
+    const char *uri;
+    const char *clen;
+    size_t ulen;
+    size_t len;
+    size_t head;
+    unsigned long long body = 0;
+
+    /* the newlines that end the previous record */
+    while((r->start < r->end) &&
+          ((r->buf[r->start] == '\r') || (r->buf[r->start] == '\n')))
+      r->start++;
+    p = &r->buf[r->start];
+    len = r->end - r->start;
+    head = warchead(p, len);
+    if(!head) {
+      if(more && (len < WARC_MAXHEAD)) {
+        more = readerfill(o, r);
+        continue;
+      }
+      if(!len)
+        break;
+      errorf(o, ERROR_FILE, "--url-file: bad WARC input");
+    }
+    if((len < 5) || memcmp(p, "WARC/", 5))
+      errorf(o, ERROR_FILE, "--url-file: bad WARC input");
+
+    /* the header lines, after the version line */
+    end = &p[head];
+    row->nraw = 0;
+    p = (const char *)memchr(p, '\n', head) + 1;
+    while((p < end) && (row->nraw < MAX_FIELDS)) {
+      const char *nl = memchr(p, '\n', end - p);
+      const char *eol = nl;
+      if((eol > p) && (eol[-1] == '\r'))
+        eol--;
+      if(eol > p) {
+        row->raw[row->nraw] = p;
+        row->rawlen[row->nraw++] = eol - p;
+      }
+      p = nl + 1;
+    }
+    if(warcfield(row, "Content-Length", &clen, &len) && len) {
+      char *cend;
+      body = strtoull(clen, &cend, 10);
+      if(!ISDIGIT(*clen) || (cend != &clen[len]))
+        errorf(o, ERROR_FILE, "--url-file: bad WARC Content-Length");
+    }
+    if(warcfield(row, "WARC-Target-URI", &uri, &ulen) && ulen) {
+      size_t slen;
+      char *u;
+      if((ulen > 1) && (uri[0] == '<') && (uri[ulen - 1] == '>')) {
+        /* as in the grammar of the WARC 1.0 spec */
+        uri++;
+        ulen -= 2;
+      }
+      u = logbuf(o, row, ulen);
+      memcpy(u, uri, ulen);
+      u[ulen] = 0;
+      slen = urlscheme(u);
+      if(!slen || !strncmp(&u[slen], "//", 2)) {
+        /* not for a dns: or similar record */
+        struct iterinfo iinfo;
+        row->url = u;
+        memset(&iinfo, 0, sizeof(iinfo));
+        singleurl(o, u, &iinfo, o->iter_list);
+      }
+    }
+    r->start += head;
+    readerskip(o, r, body);
+    if(r->start == r->end)
+      more = readerfill(o, r);
+  }
+  fflush(o->out);
+}
+
+/*
+ * --input-format pcap reads packet captures, in the pcap or pcapng file
+ * format, and finds the HTTP/1 requests sent over TCP in them. Only the
+ * client to server direction of each stream is followed and only as far as
+ * to the end of the request head. Request bodies are skipped using the
+ * Content-Length, streams with data that does not start with a request are
+ * ignored until one does.
+ */
+
+#define PCAP_MAXPKT (READBUF / 2) /* the part of a packet looked at */
+#define PCAP_FLOWS 4096 /* TCP streams followed at the same time */
+#define PCAP_HEAD 8192  /* longest request head */
+#define PCAP_IFACES 32  /* pcapng interfaces */
+#define PCAP_KEY 37     /* family, addresses and ports */
+
+/* TCP stream states */
+#define FLOW_SEEK 0 /* waiting for a request */
+#define FLOW_HEAD 1 /* in a request head */
+#define FLOW_BODY 2 /* in a request body */
+
+struct pcapflow {
+  unsigned char key[PCAP_KEY]; /* all zero when not used */
+  uint32_t seq;  /* the next sequence number */
+  int state;
+  unsigned long long body; /* body bytes left */
+  char *head;
+  size_t headlen;
+};
+
+struct pcapfile {
+  bool ng;
+  bool big;    /* big endian file */
+  int digits;  /* in the fraction of a timestamp */
+  int linktype;
+  int ifaces;  /* pcapng */
+  int iflink[PCAP_IFACES];
+  int ifshift[PCAP_IFACES]; /* binary timestamp resolution, or 0 */
+  unsigned long long ifunits[PCAP_IFACES]; /* decimal resolution */
+  int ifdigits[PCAP_IFACES];
+  struct pcapflow *flows;
+  /* the current packet */
+  unsigned char key[PCAP_KEY];
+  char client[64];
+  char server[64];
+  const char *serverip; /* the host part of 'server' */
+  size_t serveriplen;
+  uint16_t serverport;
+  char time[48];
+};
+
+static uint16_t pcap16(const unsigned char *p, bool big)
+{
+  return big ? (uint16_t)((p[0] << 8) | p[1]) :
+    (uint16_t)((p[1] << 8) | p[0]);
+}
+
+static uint32_t pcap32(const unsigned char *p, bool big)
+{
+  return big ?
+    ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+    ((uint32_t)p[2] << 8) | p[3] :
+    ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) |
+    ((uint32_t)p[1] << 8) | p[0];
+}
+
+/* network data is big endian */
+#define NET16(p) pcap16(p, true)
+#define NET32(p) pcap32(p, true)
+
+static const char *const httpmethods[] = {
+  "GET ", "POST ", "HEAD ", "PUT ", "DELETE ", "OPTIONS ", "PATCH ",
+  "TRACE ", "CONNECT ", NULL
+};
+
+/* does the data start with an HTTP request line? */
+static bool pcaprequest(const char *p, size_t len)
+{
+  int i;
+  if((len < 4) || !ISUPPER(*p))
+    return false;
+  for(i = 0; httpmethods[i]; i++) {
+    size_t mlen = strlen(httpmethods[i]);
+    if((len >= mlen) && !memcmp(p, httpmethods[i], mlen))
+      return true;
+  }
+  return false;
+}
+
+/* the value of a header in a request head */
+static bool pcapheader(const char *head, size_t len, const char *name,
+                       const char **ptr, size_t *vlen)
+{
+  const char *end = &head[len];
+  size_t nlen = strlen(name);
+  const char *p = memchr(head, '\n', len);
+  while(p && (++p < end)) {
+    const char *eol = memchr(p, '\n', end - p);
+    if(!eol)
+      break;
+    if(((size_t)(eol - p) > nlen) && (p[nlen] == ':') &&
+       !casecompare(p, name, nlen)) {
+      p += nlen + 1;
+      while((p < eol) && ((*p == ' ') || (*p == '\t')))
+        p++;
+      while((eol > p) && ((eol[-1] == '\r') || (eol[-1] == ' ') ||
+                          (eol[-1] == '\t')))
+        eol--;
+      *ptr = p;
+      *vlen = eol - p;
+      return true;
+    }
+    p = eol;
+  }
+  *ptr = NULL;
+  *vlen = 0;
+  return false;
+}
+
+/* a complete request head, output its URL and decide what comes next */
+static void pcaphead(struct option *o, struct pcapfile *pf,
+                     struct pcapflow *f, size_t len)
+{
+  struct row *r = o->row;
+  const char *host;
+  const char *val;
+  size_t hlen;
+  size_t vlen;
+  char port[8];
+  size_t plen = 0;
+
+  r->url = NULL;
+  r->raw[PCAP_REQUEST] = f->head;
+  r->rawlen[PCAP_REQUEST] = strcspn(f->head, "\r\n");
+  logrequest(r, PCAP_REQUEST, PCAP_METHOD, PCAP_TARGET, PCAP_PROTOCOL);
+  pcapheader(f->head, len, "Host", &host, &hlen);
+  r->raw[PCAP_HOST] = host;
+  r->rawlen[PCAP_HOST] = hlen;
+  r->raw[PCAP_CLIENT] = pf->client;
+  r->rawlen[PCAP_CLIENT] = strlen(pf->client);
+  r->raw[PCAP_SERVER] = pf->server;
+  r->rawlen[PCAP_SERVER] = strlen(pf->server);
+  r->raw[PCAP_TIME] = pf->time;
+  r->rawlen[PCAP_TIME] = strlen(pf->time);
+
+  f->state = FLOW_SEEK;
+  if((r->rawlen[PCAP_METHOD] == 7) &&
+     !memcmp(r->raw[PCAP_METHOD], "CONNECT", 7))
+    /* a tunnel, no more requests in this stream */
+    return;
+  if(pcapheader(f->head, len, "Transfer-Encoding", &val, &vlen) &&
+     (vlen == 7) && !casecompare(val, "chunked", 7))
+    /* skipped by waiting for the next request */
+    ;
+  else if(pcapheader(f->head, len, "Content-Length", &val, &vlen) && vlen &&
+          ISDIGIT(*val)) {
+    f->body = strtoull(val, NULL, 10);
+    if(f->body)
+      f->state = FLOW_BODY;
+  }
+
+  if(!hlen) {
+    /* HTTP/1.0 without Host:, use the server address */
+    host = pf->serverip;
+    hlen = pf->serveriplen;
+    if(pf->serverport != 80)
+      plen = (size_t)curl_msnprintf(port, sizeof(port), "%u",
+                                    (unsigned int)pf->serverport);
+  }
+  if(logurl(o, r, "http", 4, host, hlen, port, plen, r->raw[PCAP_TARGET],
+            r->rawlen[PCAP_TARGET], NULL, 0)) {
+    struct iterinfo iinfo;
+    memset(&iinfo, 0, sizeof(iinfo));
+    singleurl(o, r->url, &iinfo, o->iter_list);
+  }
+}
+
+/* TCP payload from the client */
+static void pcapdata(struct option *o, struct pcapfile *pf,
+                     struct pcapflow *f, const char *p, size_t len)
+{
+  while(len) {
+    switch(f->state) {
+    case FLOW_SEEK:
+      if(!pcaprequest(p, len))
+        return;
+      f->state = FLOW_HEAD;
+      f->headlen = 0;
+      break;
+    case FLOW_BODY: {
+      size_t n = (f->body < len) ? (size_t)f->body : len;
+      f->body -= n;
+      p += n;
+      len -= n;
+      if(!f->body)
+        f->state = FLOW_SEEK;
+      break;
+    }
+    default: {
+      size_t old = f->headlen;
+      size_t from = (old > 3) ? old - 3 : 0;
+      size_t n = PCAP_HEAD - 1 - old;
+      const char *e;
+      if(!f->head) {
+        f->head = malloc(PCAP_HEAD);
+        if(!f->head)
+          errorf(o, ERROR_MEM, "out of memory");
+      }
+      if(n > len)
+        n = len;
+      memcpy(&f->head[old], p, n);
+      f->headlen += n;
+      f->head[f->headlen] = 0;
+      e = memmem(&f->head[from], f->headlen - from, "\r\n\r\n", 4);
+      if(!e) {
+        if(f->headlen == (PCAP_HEAD - 1))
+          /* too long, give up on this request */
+          f->state = FLOW_SEEK;
+        return;
+      }
+      n = (e - f->head) + 4 - old; /* used of this data */
+      p += n;
+      len -= n;
+      pcaphead(o, pf, f, (e - f->head) + 4);
+      break;
+    }
+    }
+  }
+}
+
+static uint32_t pcaphash(const unsigned char *key)
+{
+  uint32_t h = 2166136261U;
+  int i;
+  for(i = 0; i < PCAP_KEY; i++) {
+    h ^= key[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/* a TCP segment */
+static void pcaptcp(struct option *o, struct pcapfile *pf,
+                    const unsigned char *tcp, size_t len)
+{
+  struct pcapflow *f;
+  size_t hlen;
+  uint32_t seq;
+  unsigned char flags;
+
+  if(len < 20)
+    return;
+  hlen = (size_t)(tcp[12] >> 4) * 4;
+  if((hlen < 20) || (hlen > len))
+    return;
+  seq = NET32(&tcp[4]);
+  flags = tcp[13];
+  memcpy(&pf->key[33], tcp, 4); /* the ports */
+  pf->serverport = NET16(&tcp[2]);
+  curl_msnprintf(&pf->client[strlen(pf->client)],
+                 sizeof(pf->client) - strlen(pf->client), ":%u",
+                 (unsigned int)NET16(tcp));
+  curl_msnprintf(&pf->server[strlen(pf->server)],
+                 sizeof(pf->server) - strlen(pf->server), ":%u",
+                 (unsigned int)pf->serverport);
+
+  f = &pf->flows[pcaphash(pf->key) % PCAP_FLOWS];
+  if(memcmp(f->key, pf->key, PCAP_KEY) || (flags & 0x02)) {
+    /* a new stream, or one taking over the slot */
+    memcpy(f->key, pf->key, PCAP_KEY);
+    f->state = FLOW_SEEK;
+    f->seq = seq + ((flags & 0x02) ? 1 : 0);
+  }
+  else {
+    /* also when looking for a request, so that one is not seen twice */
+    int32_t diff = (int32_t)(seq - f->seq);
+    if(diff < 0) {
+      /* retransmitted data */
+      if((size_t)-(int64_t)diff >= (len - hlen))
+        return;
+      hlen += (size_t)-(int64_t)diff;
+      seq = f->seq;
+    }
+    else if(diff > 0)
+      /* data was lost */
+      f->state = FLOW_SEEK;
+  }
+  f->seq = seq + (uint32_t)(len - hlen);
+  pcapdata(o, pf, f, (const char *)&tcp[hlen], len - hlen);
+  if(flags & 0x05) {
+    /* FIN or RST */
+    free(f->head);
+    memset(f, 0, sizeof(*f));
+  }
+}
+
+/* an IPv4 or IPv6 packet */
+static void pcapip(struct option *o, struct pcapfile *pf,
+                   const unsigned char *ip, size_t len)
+{
+  char addr[48];
+  size_t hlen;
+  unsigned char proto;
+
+  memset(pf->key, 0, sizeof(pf->key));
+  if(len < 1)
+    return;
+  if((ip[0] >> 4) == 4) {
+    size_t total;
+    if(len < 20)
+      return;
+    hlen = (size_t)(ip[0] & 0x0f) * 4;
+    total = NET16(&ip[2]);
+    if((hlen < 20) || (total < hlen))
+      return;
+    if(NET16(&ip[6]) & 0x1fff)
+      /* not the first fragment */
+      return;
+    if(total < len)
+      /* ethernet padding */
+      len = total;
+    proto = ip[9];
+    pf->key[0] = 4;
+    memcpy(&pf->key[1], &ip[12], 8);
+    curl_msnprintf(pf->client, sizeof(pf->client), "%u.%u.%u.%u",
+                   ip[12], ip[13], ip[14], ip[15]);
+    curl_msnprintf(addr, sizeof(addr), "%u.%u.%u.%u",
+                   ip[16], ip[17], ip[18], ip[19]);
+  }
+  else if((ip[0] >> 4) == 6) {
+    size_t total;
+    int i;
+    char *a;
+    if(len < 40)
+      return;
+    total = (size_t)NET16(&ip[4]) + 40;
+    if(total < len)
+      len = total;
+    proto = ip[6];
+    hlen = 40;
+    /* extension headers: hop-by-hop, routing and destination options */
+    while(((proto == 0) || (proto == 43) || (proto == 60)) &&
+          ((hlen + 8) <= len)) {
+      proto = ip[hlen];
+      hlen += ((size_t)ip[hlen + 1] + 1) * 8;
+    }
+    pf->key[0] = 6;
+    memcpy(&pf->key[1], &ip[8], 32);
+    a = pf->client;
+    *a++ = '[';
+    for(i = 0; i < 16; i += 2)
+      a += curl_msnprintf(a, 6, "%s%x", i ? ":" : "",
+                          (unsigned int)NET16(&ip[8 + i]));
+    memcpy(a, "]", 2);
+    a = addr;
+    *a++ = '[';
+    for(i = 0; i < 16; i += 2)
+      a += curl_msnprintf(a, 6, "%s%x", i ? ":" : "",
+                          (unsigned int)NET16(&ip[24 + i]));
+    memcpy(a, "]", 2);
+  }
+  else
+    return;
+  if((proto != 6) || (hlen > len))
+    return;
+  strcpy(pf->server, addr);
+  pf->serverip = pf->server;
+  pf->serveriplen = strlen(addr);
+  pcaptcp(o, pf, &ip[hlen], len - hlen);
+}
+
+/* a captured packet */
+static void pcappacket(struct option *o, struct pcapfile *pf, int linktype,
+                       const unsigned char *p, size_t len)
+{
+  size_t off;
+  uint16_t type;
+  switch(linktype) {
+  case 1: /* Ethernet */
+    if(len < 14)
+      return;
+    type = NET16(&p[12]);
+    off = 14;
+    while(((type == 0x8100) || (type == 0x88a8)) && ((off + 4) <= len)) {
+      /* VLAN tag */
+      type = NET16(&p[off + 2]);
+      off += 4;
+    }
+    if((type != 0x0800) && (type != 0x86dd))
+      return;
+    break;
+  case 0:   /* BSD loopback */
+  case 108: /* OpenBSD loopback */
+    off = 4;
+    break;
+  case 113: /* Linux cooked */
+    off = 16;
+    break;
+  case 276: /* Linux cooked v2 */
+    off = 20;
+    break;
+  case 12:  /* raw IP */
+  case 14:
+  case 101:
+  case 228:
+  case 229:
+    off = 0;
+    break;
+  default:
+    return;
+  }
+  if(off <= len)
+    pcapip(o, pf, &p[off], len - off);
+}
+
+/* set the timestamp of the current packet */
+static void pcaptime(struct pcapfile *pf, unsigned long long sec,
+                     unsigned long long frac, int digits)
+{
+  if(digits)
+    curl_msnprintf(pf->time, sizeof(pf->time), "%llu.%0*llu", sec, digits,
+                   frac);
+  else
+    curl_msnprintf(pf->time, sizeof(pf->time), "%llu", sec);
+}
+
+/* handle the next packet and skip what is not looked at, 'hlen' is the
+   size of the record header */
+static void pcapnext(struct option *o, struct pcapfile *pf, int linktype,
+                     size_t hlen, unsigned long long caplen,
+                     unsigned long long total)
+{
+  struct urlreader *r = o->reader;
+  size_t len = (caplen > PCAP_MAXPKT) ? PCAP_MAXPKT : (size_t)caplen;
+  if(!readerneed(o, r, hlen + len)) {
+    trurl_warnf(o, "--url-file: truncated capture");
+    r->start = r->end;
+    return;
+  }
+  pcappacket(o, pf, linktype, (const unsigned char *)&r->buf[r->start + hlen],
+             len);
+  r->start += hlen + len;
+  readerskip(o, r, total - hlen - len);
+}
+
+/* a pcapng block */
+static void pcapblock(struct option *o, struct pcapfile *pf)
+{
+  struct urlreader *r = o->reader;
+  const unsigned char *b = (const unsigned char *)&r->buf[r->start];
+  uint32_t type = pcap32(b, pf->big);
+  uint32_t blen = pcap32(&b[4], pf->big);
+  int i;
+
+  if((blen < 12) || (blen & 3))
+    errorf(o, ERROR_FILE, "--url-file: bad pcapng input");
+  switch(type) {
+  case 1: /* interface description */
+    if(!readerneed(o, r, (blen < PCAP_MAXPKT) ? blen : PCAP_MAXPKT) ||
+       (blen < 20))
+      break;
+    b = (const unsigned char *)&r->buf[r->start];
+    if(pf->ifaces < PCAP_IFACES) {
+      const unsigned char *opt = &b[16];
+      const unsigned char *end = &b[((blen < PCAP_MAXPKT) ?
+                                     blen : PCAP_MAXPKT) - 4];
+      i = pf->ifaces++;
+      pf->iflink[i] = pcap16(&b[8], pf->big);
+      pf->ifshift[i] = 0;
+      pf->ifunits[i] = 1000000;
+      pf->ifdigits[i] = 6;
+      while((opt + 4) <= end) {
+        uint16_t code = pcap16(opt, pf->big);
+        uint16_t olen = pcap16(&opt[2], pf->big);
+        if(!code || ((opt + 4 + olen) > end))
+          break;
+        if((code == 9) && (olen == 1)) {
+          /* if_tsresol */
+          int res = opt[4] & 0x7f;
+          if(opt[4] & 0x80)
+            pf->ifshift[i] = (res < 64) ? res : 63;
+          else if(res <= 19) {
+            pf->ifdigits[i] = res;
+            for(pf->ifunits[i] = 1; res; res--)
+              pf->ifunits[i] *= 10;
+          }
+        }
+        opt += 4 + ((olen + 3) & ~3);
+      }
+    }
+    break;
+  case 2: /* packet, obsolete */
+  case 6: /* enhanced packet */
+    if(!readerneed(o, r, 28) || (blen < 32))
+      break;
+    b = (const unsigned char *)&r->buf[r->start];
+    i = (type == 6) ? (int)pcap32(&b[8], pf->big) :
+      pcap16(&b[8], pf->big);
+    if(i < pf->ifaces) {
+      unsigned long long ts =
+        ((unsigned long long)pcap32(&b[12], pf->big) << 32) |
+        pcap32(&b[16], pf->big);
+      uint32_t caplen = pcap32(&b[20], pf->big);
+      if(caplen > (blen - 32))
+        caplen = blen - 32;
+      if(pf->ifshift[i]) {
+        int s = pf->ifshift[i];
+        pcaptime(pf, ts >> s,
+                 ((ts & ((1ULL << s) - 1)) * 1000000) >> s, 6);
+      }
+      else
+        pcaptime(pf, ts / pf->ifunits[i], ts % pf->ifunits[i],
+                 pf->ifdigits[i]);
+      pcapnext(o, pf, pf->iflink[i], 28, caplen, blen);
+      return;
+    }
+    break;
+  case 3: /* simple packet */
+    if(readerneed(o, r, 12) && (blen >= 16) && pf->ifaces) {
+      uint32_t caplen;
+      b = (const unsigned char *)&r->buf[r->start];
+      caplen = pcap32(&b[8], pf->big);
+      if(caplen > (blen - 16))
+        caplen = blen - 16;
+      pf->time[0] = 0;
+      pcapnext(o, pf, pf->iflink[0], 12, caplen, blen);
+      return;
+    }
+    break;
+  case 0x0a0d0d0a: /* section header, a new section */
+    if(!readerneed(o, r, 12))
+      break;
+    b = (const unsigned char *)&r->buf[r->start];
+    pf->big = (b[8] == 0x1a);
+    pf->ifaces = 0;
+    blen = pcap32(&b[4], pf->big);
+    if((blen < 12) || (blen & 3))
+      errorf(o, ERROR_FILE, "--url-file: bad pcapng input");
+    break;
+  default:
+    break;
+  }
+  readerskip(o, r, blen);
+}
+
+/* handle all packets in the --url-file */
+static void pcaprun(struct option *o)
+{
+  struct urlreader *r = o->reader;
+  struct pcapfile pf;
+  const unsigned char *b;
+  uint32_t magic;
+  int i;
+
+  memset(&pf, 0, sizeof(pf));
+  if(!readerneed(o, r, 24))
+    errorf(o, ERROR_FILE, "--url-file: not a pcap file");
+  b = (const unsigned char *)&r->buf[r->start];
+  magic = pcap32(b, false);
+  if(magic == 0x0a0d0d0a)
+    pf.ng = true;
+  else if((magic == 0xd4c3b2a1) || (magic == 0x4d3cb2a1))
+    pf.big = true;
+  else if((magic != 0xa1b2c3d4) && (magic != 0xa1b23c4d))
+    errorf(o, ERROR_FILE, "--url-file: not a pcap file");
+  if(!pf.ng) {
+    pf.digits = ((magic == 0xa1b23c4d) || (magic == 0x4d3cb2a1)) ? 9 : 6;
+    pf.linktype = (int)(pcap32(&b[20], pf.big) & 0xffff);
+    r->start += 24;
+  }
+
+  pf.flows = calloc(PCAP_FLOWS, sizeof(struct pcapflow));
+  if(!pf.flows)
+    errorf(o, ERROR_MEM, "out of memory");
+  for(;;) {
+    if(!readerneed(o, r, pf.ng ? 12 : 16)) {
+      if(r->end != r->start)
+        trurl_warnf(o, "--url-file: truncated capture");
+      break;
+    }
+    b = (const unsigned char *)&r->buf[r->start];
+    if(pf.ng)
+      pcapblock(o, &pf);
+    else {
+      uint32_t caplen = pcap32(&b[8], pf.big);
+      pcaptime(&pf, pcap32(b, pf.big), pcap32(&b[4], pf.big), pf.digits);
+      pcapnext(o, &pf, pf.linktype, 16, caplen,
+               (unsigned long long)caplen + 16);
+    }
+  }
+  for(i = 0; i < PCAP_FLOWS; i++)
+    free(pf.flows[i].head);
+  free(pf.flows);
+  fflush(o->out);
+}
+
+/* the offset where part 'i' of 'n' starts */
+static unsigned long long partoffset(unsigned long long size,
+                                     unsigned long i, unsigned long n)
+{
+  return size / n * i + size % n * i / n;
+}
+
+/* go to the first record of the --input-range or --part */
+static void rangestart(struct option *o, struct urlreader *r)
+{
+  if(o->parts) {
+    struct stat st;
+    unsigned long long size;
+    if((r->enc != ENC_NONE) || fstat(fileno(o->url), &st) ||
+       !S_ISREG(st.st_mode))
+      errorf(o, ERROR_FLAG, "--part needs an uncompressed file");
+    size = (unsigned long long)st.st_size;
+    o->range_start = partoffset(size, o->part - 1, o->parts);
+    o->range_end = partoffset(size, o->part, o->parts);
+    if(o->part == o->parts)
+      /* all of the rest */
+      o->range_end = 0;
+    else if(o->range_end == o->range_start) {
+      /* nothing */
+      r->start = r->end;
+      r->eof = true;
+      return;
+    }
+  }
+  if(o->range_start) {
+    /* the record that starts at the range start might be the first */
+    readerskip(o, r, o->range_start - 1);
+    readeralign(o, r);
+  }
+}
+
+/*
+ * --checkpoint FILE saves the --url-file offset and the number of records
+ * done so far, at most once per second and when done. It is only saved
+ * after the output of those records is flushed, and it replaces the old
+ * one atomically with a rename. --resume continues from there, which also
+ * works to only process the lines added to a growing file since the last
+ * run.
+ */
+#define CHECKPOINT_SECS 1
+
+static void checkpointsave(struct option *o)
+{
+  struct urlreader *r = o->reader;
+  size_t nlen = strlen(o->checkpoint);
+  char *tmp = malloc(nlen + 5);
+  FILE *f;
+
+  if(!tmp)
+    errorf(o, ERROR_MEM, "out of memory");
+  curl_msnprintf(tmp, nlen + 5, "%s.tmp", o->checkpoint);
+
+  /* the output up to here must be stored before the checkpoint is */
+  if(fflush(o->out))
+    errorf(o, ERROR_OUTPUT, "output: %s", strerror(errno));
+#ifndef _MSC_VER
+  (void)fsync(fileno(o->out)); /* fails for pipes and terminals */
+#endif
+  f = fopen(tmp, "w");
+  if(!f)
+    errorf(o, ERROR_FILE, "--checkpoint %s: %s", tmp, strerror(errno));
+  fprintf(f, "file %s\noffset %llu\nrecords %llu\n",
+          o->url_files->data, r->base + r->start, o->records);
+  if(o->output) {
+    struct stat st;
+    if(!fstat(fileno(o->out), &st))
+      fprintf(f, "output %llu\n", (unsigned long long)st.st_size);
+  }
+#ifndef _MSC_VER
+  if(fflush(f) || fsync(fileno(f)))
+    errorf(o, ERROR_FILE, "--checkpoint %s: %s", tmp, strerror(errno));
+#endif
+  if(fclose(f))
+    errorf(o, ERROR_FILE, "--checkpoint %s: %s", tmp, strerror(errno));
+#ifdef _MSC_VER
+  /* rename() does not replace files on Windows */
+  remove(o->checkpoint);
+#endif
+  if(rename(tmp, o->checkpoint))
+    errorf(o, ERROR_FILE, "--checkpoint %s: %s", o->checkpoint,
+           strerror(errno));
+  free(tmp);
+  o->checkpointed = time(NULL);
+  o->checkpointrecords = o->records;
+}
+
+#endif /* !TRURL_LIBRARY */
+
+/* read the --checkpoint file for --resume */
+static void checkpointload(struct option *o)
+{
+  char line[MAX_LINE];
+  FILE *f = fopen(o->checkpoint, "r");
+  if(!f) {
+    if(errno == ENOENT)
+      /* the first run */
+      return;
+    errorf(o, ERROR_FILE, "--checkpoint %s: %s", o->checkpoint,
+           strerror(errno));
+  }
+  while(fgets(line, sizeof(line), f)) {
+    size_t len = strcspn(line, "\r\n");
+    line[len] = 0;
+    if(!strncmp(line, "file ", 5)) {
+      if(strcmp(&line[5], o->url_files->data)) {
+        fclose(f);
+        errorf(o, ERROR_FILE, "--checkpoint %s is for %s", o->checkpoint,
+               &line[5]);
+      }
+    }
+    else if(!strncmp(line, "offset ", 7))
+      o->resume_offset = strtoull(&line[7], NULL, 10);
+    else if(!strncmp(line, "records ", 8))
+      o->records = strtoull(&line[8], NULL, 10);
+    else if(!strncmp(line, "output ", 7)) {
+      o->outsize = strtoull(&line[7], NULL, 10);
+      o->outsized = true;
+    }
+  }
+  fclose(f);
+}
+
+#ifndef TRURL_LIBRARY
+/* continue from the --checkpoint offset */
+static void checkpointresume(struct option *o, struct urlreader *r)
+{
+  unsigned long long now = r->base + r->start;
+  struct stat st;
+  if((r->enc == ENC_NONE) && !fstat(fileno(o->url), &st) &&
+     S_ISREG(st.st_mode) &&
+     (o->resume_offset > (unsigned long long)st.st_size)) {
+    /* the file is smaller than before, it was probably rotated */
+    trurl_warnf(o, "--checkpoint %s is past the end of %s, starting over",
+                o->checkpoint, o->url_files->data);
+    o->records = 0;
+    return;
+  }
+  if(o->resume_offset > now)
+    readerskip(o, r, o->resume_offset - now);
+}
+
+#ifdef SUPPORTS_FOLLOW
+/*
+ * --follow keeps reading the --url-file as it grows, like 'tail -F'. On
+ * Linux it sleeps in inotify until the file or its directory changes,
+ * elsewhere it checks ten times per second. When the file name gets a new
+ * file, the old one is read to its end first. A file that shrinks was
+ * truncated and is read again from the start.
+ */
+#define FOLLOW_POLL 100 /* milliseconds between checks without inotify */
+#define FOLLOW_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+struct follow {
+  int fd; /* inotify, or -1 */
+  int filewd; /* watches the file being read */
+};
+
+static void followinit(struct option *o, struct follow *fw)
+{
+  fw->fd = -1;
+  fw->filewd = -1;
+#ifdef SUPPORTS_INOTIFY
+  {
+    const char *name = o->url_files->data;
+    const char *slash = strrchr(name, '/');
+    char *dir = NULL;
+    int dirwd = -1;
+    fw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fw->fd < 0)
+      return;
+    if(slash)
+      dir = curl_maprintf("%.*s", (slash == name) ? 1 : (int)(slash - name),
+                          name);
+    /* a new file with the name shows up in the directory */
+    dirwd = inotify_add_watch(fw->fd, dir ? dir : ".",
+                              IN_CREATE | IN_MOVED_TO);
+    curl_free(dir);
+    fw->filewd = inotify_add_watch(fw->fd, name, FOLLOW_EVENTS);
+    if((dirwd < 0) || (fw->filewd < 0)) {
+      /* check every now and then instead */
+      close(fw->fd);
+      fw->fd = -1;
+    }
+  }
+#else
+  (void)o;
+#endif
+}
+
+/* sleep until something happens or for 'timeout' milliseconds, -1 for no
+   limit. Returns false on timeout. */
+static bool followsleep(struct follow *fw, int timeout)
+{
+#ifdef SUPPORTS_INOTIFY
+  if(fw->fd >= 0) {
+    struct pollfd pfd;
+    char events[4096];
+    pfd.fd = fw->fd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, timeout) <= 0)
+      return false;
+    /* the events only say that it is time to look again */
+    while(read(fw->fd, events, sizeof(events)) > 0)
+      ;
+    return true;
+  }
+#else
+  (void)fw;
+#endif
+  if((timeout >= 0) && (timeout < FOLLOW_POLL)) {
+    poll(NULL, 0, timeout);
+    return false;
+  }
+  poll(NULL, 0, FOLLOW_POLL);
+  return true;
+}
+
+/* read from the start of the (new) file */
+static void followreset(struct urlreader *r)
+{
+  r->base = 0;
+  r->start = r->end = 0;
+}
+
+/* wait until there is more to read in the --url-file or for 'timeout'
+   milliseconds, -1 for no limit */
+static void followwait(struct option *o, struct urlreader *r,
+                       struct follow *fw, int timeout)
+{
+  const char *name = o->url_files->data;
+  unsigned long long pos = r->base + r->end; /* read so far */
+  time_t started = time(NULL);
+  for(;;) {
+    struct stat cur;
+    struct stat st;
+    if(fstat(fileno(o->url), &cur))
+      errorf(o, ERROR_FILE, "--follow %s: %s", name, strerror(errno));
+    if((unsigned long long)cur.st_size < pos) {
+      trurl_warnf(o, "%s was truncated", name);
+      if(fseeko(o->url, 0, SEEK_SET))
+        errorf(o, ERROR_FILE, "--follow %s: %s", name, strerror(errno));
+      followreset(r);
+      break;
+    }
+    if((unsigned long long)cur.st_size > pos)
+      break;
+    if(!stat(name, &st) &&
+       ((st.st_ino != cur.st_ino) || (st.st_dev != cur.st_dev))) {
+      /* the name has a new file and the old one is read to its end */
+      FILE *f = fopen(name, "rb");
+      if(f) {
+        fclose(o->url);
+        o->url = f;
+        followreset(r);
+#ifdef SUPPORTS_INOTIFY
+        if(fw->fd >= 0) {
+          inotify_rm_watch(fw->fd, fw->filewd);
+          fw->filewd = inotify_add_watch(fw->fd, name, FOLLOW_EVENTS);
+        }
+#endif
+        break;
+      }
+    }
+    if(timeout >= 0) {
+      int left = timeout - (int)(time(NULL) - started) * 1000;
+      if((left <= 0) || !followsleep(fw, left))
+        break;
+    }
+    else
+      followsleep(fw, -1);
+  }
+  /* read again after the end of file */
+  clearerr(o->url);
+  r->rawend = r->eof = false;
+}
+
+/* the --url-file has been read to its end for now: output what there is,
+   save a --checkpoint when due and wait for more */
+static void followmore(struct option *o, struct follow *fw)
+{
+  int timeout = -1;
+  if(o->checkpoint && (o->records != o->checkpointrecords)) {
+    time_t left = CHECKPOINT_SECS - (time(NULL) - o->checkpointed);
+    if(left <= 0)
+      checkpointsave(o);
+    else
+      timeout = (int)left * 1000;
+  }
+  followwait(o, o->reader, fw, timeout);
+}
+#endif /* SUPPORTS_FOLLOW */
+
+/* process the URLs in the --url-file line by line */
+static void linerun(struct option *o)
+{
+  struct batch *b = calloc(1, sizeof(struct batch));
+  int maxlines = 1;
+  size_t used = 0;
+  int len;
+#ifdef SUPPORTS_FOLLOW
+  struct follow fw;
+#endif
+
+  if(!b)
+    errorf(o, ERROR_MEM, "out of memory");
+  b->buf = malloc(BATCH_LINES * MAX_LINE);
+  if(!b->buf) {
+    free(b);
+    errorf(o, ERROR_MEM, "out of memory");
+  }
+
+  /* only collect lines ahead when not interactive */
+  if(o->reader->block)
+    maxlines = BATCH_LINES;
+
+  if(o->ranged)
+    rangestart(o, o->reader);
+  if(o->resume)
+    checkpointresume(o, o->reader);
+  o->checkpointed = time(NULL);
+  o->checkpointrecords = o->records;
+#ifdef SUPPORTS_FOLLOW
+  if(o->follow) {
+    if(o->reader->enc != ENC_NONE)
+      errorf(o, ERROR_FLAG, "--follow needs an uncompressed file");
+    followinit(o, &fw);
+  }
+#endif
+
+  for(;;) {
+    len = readurl(o, &b->buf[used], MAX_LINE);
+    if(len < 0) {
+#ifdef SUPPORTS_FOLLOW
+      if(o->follow) {
+        if(b->lines) {
+          batchrun(o, b);
+          used = 0;
+        }
+        followmore(o, &fw);
+        continue;
+      }
+#endif
+      break;
+    }
+    b->off[b->lines] = used;
+    b->len[b->lines] = (uint16_t)len;
+    b->lines++;
+    o->records++;
+    used += (size_t)len + 1;
+    if(b->lines == maxlines) {
+      batchrun(o, b);
+      used = 0;
+      if(o->checkpoint &&
+         ((time(NULL) - o->checkpointed) >= CHECKPOINT_SECS))
+        checkpointsave(o);
+    }
+  }
+  if(b->lines)
+    batchrun(o, b);
+  if(o->checkpoint)
+    checkpointsave(o);
+  free(b->buf);
+  free(b);
+}
+
+#ifdef SUPPORTS_PIPELINE
+/*
+ * --pipeline runs the work on a --url-file in three stages: a reader thread
+ * splits the input into batches of lines, the main thread processes them
+ * with batchrun() and a writer thread writes the output. The stages are
+ * connected by bounded single producer, single consumer rings. Each ring
+ * passes on pointers with atomic head and tail counters and only sleeps on
+ * its condition variable when it is full or empty, which is what holds back
+ * a stage that gets ahead. The batches and the output blocks go back to
+ * their producer through a ring of free ones.
+ */
+
+#define PIPE_BATCHES 8 /* batches in flight, a power of two */
+#define PIPE_BLOCKS 8  /* output blocks in flight, a power of two */
+#define PIPE_BLOCK (256*1024)
+#define RING_SPIN 100  /* checks before going to sleep */
+
+struct ring {
+  void **slots;
+  unsigned int size;     /* a power of two */
+  unsigned int head;     /* the next to get, moved by the consumer */
+  unsigned int tail;     /* the next to put, moved by the producer */
+  int sleeping;          /* a side waits for the other */
+  bool closed;           /* no more puts */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct pipeblock {
+  size_t len;
+  char data[PIPE_BLOCK];
+};
+
+struct pipeline {
+  struct ring full;      /* batches to process */
+  struct ring empty;     /* processed batches */
+  struct ring out;       /* blocks to write */
+  struct ring spare;     /* written blocks */
+  struct batch batches[PIPE_BATCHES];
+  struct pipeblock *fill; /* the output block being filled */
+  FILE *stream;          /* o->out while the pipeline runs */
+  FILE *file;            /* the output it writes to */
+  pthread_t main;
+  pthread_t reader;
+  pthread_t writer;
+  int code;              /* the reader failed with this exit code */
+  char error[256];
+};
+
+static void ringinit(struct option *o, struct ring *r, unsigned int size)
+{
+  memset(r, 0, sizeof(*r));
+  r->slots = calloc(size, sizeof(void *));
+  if(!r->slots)
+    errorf(o, ERROR_MEM, "out of memory");
+  r->size = size;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->cond, NULL);
+}
+
+static void ringfree(struct ring *r)
+{
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  free(r->slots);
+}
+
+/* true when the ring is full for the producer or empty for the consumer */
+static bool ringblocked(struct ring *r, bool put)
+{
+  unsigned int head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+  unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+  if(put)
+    return (tail - head) == r->size;
+  return (head == tail) && !__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST);
+}
+
+/* wait for the other side to make room or add something */
+static void ringwait(struct ring *r, bool put)
+{
+  int i;
+  for(i = 0; i < RING_SPIN; i++)
+    if(!ringblocked(r, put))
+      return;
+  pthread_mutex_lock(&r->lock);
+  /* the other side checks 'sleeping' after it moves head or tail */
+  __atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+  if(ringblocked(r, put))
+    pthread_cond_wait(&r->cond, &r->lock);
+  __atomic_store_n(&r->sleeping, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&r->lock);
+}
+
+static void ringwake(struct ring *r)
+{
+  if(__atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+static void ringput(struct ring *r, void *item)
+{
+  unsigned int tail = r->tail;
+  while((tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == r->size)
+    ringwait(r, true);
+  r->slots[tail & (r->size - 1)] = item;
+  __atomic_store_n(&r->tail, tail + 1, __ATOMIC_SEQ_CST);
+  ringwake(r);
+}
+
+/* the next item, or NULL when the ring is closed and empty */
+static void *ringget(struct ring *r)
+{
+  unsigned int head = r->head;
+  void *item;
+  while(__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head) {
+    if(__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE) &&
+       (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head))
+      return NULL;
+    ringwait(r, false);
+  }
+  item = r->slots[head & (r->size - 1)];
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+  ringwake(r);
+  return item;
+}
+
+/* true when there is nothing for the consumer right now */
+static bool ringempty(struct ring *r)
+{
+  return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->head;
+}
+
+static void ringclose(struct ring *r)
+{
+  __atomic_store_n(&r->closed, true, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&r->lock);
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/* errorf() in the reader thread, leave the exit to the main thread */
+static void pipelinefail(struct option *o, int exit_code, const char *fmt,
+                         va_list ap)
+{
+  struct pipeline *p = o->pipe;
+  if(pthread_equal(pthread_self(), p->main))
+    return;
+  curl_mvsnprintf(p->error, sizeof(p->error), fmt, ap);
+  p->code = exit_code;
+  ringclose(&p->full);
+  pthread_exit(NULL);
+}
+
+/* the reader stage, fills batches until the end of the input */
+static void *pipereader(void *arg)
+{
+  struct option *o = arg;
+  struct pipeline *p = o->pipe;
+  struct urlreader *r = o->reader;
+  bool more = true;
+  while(more) {
+    struct batch *b = ringget(&p->empty);
+    size_t used = 0;
+    while(b->lines < BATCH_LINES) {
+      int len = readurl(o, &b->buf[used], MAX_LINE);
+      if(len < 0) {
+        more = false;
+        break;
+      }
+      b->off[b->lines] = used;
+      b->len[b->lines] = (uint16_t)len;
+      b->lines++;
+      o->records++;
+      used += (size_t)len + 1;
+      if(!r->block &&
+         !memchr(&r->buf[r->start], o->delim, r->end - r->start))
+        /* the next line might take a while, pass on what there is */
+        break;
+    }
+    if(b->lines)
+      ringput(&p->full, b);
+  }
+  ringclose(&p->full);
+  return NULL;
+}
+
+/* the writer stage */
+static void *pipewriter(void *arg)
+{
+  struct pipeline *p = arg;
+  for(;;) {
+    struct pipeblock *k;
+    if(ringempty(&p->out))
+      /* out of work for now, let the output show */
+      fflush(p->file);
+    k = ringget(&p->out);
+    if(!k)
+      break;
+    fwrite(k->data, 1, k->len, p->file);
+    k->len = 0;
+    ringput(&p->spare, k);
+  }
+  return NULL;
+}
+
+/* pass the block being filled on to the writer */
+static void pipesend(struct pipeline *p)
+{
+  if(p->fill && p->fill->len) {
+    ringput(&p->out, p->fill);
+    p->fill = NULL;
+  }
+}
+
+static ssize_t pipewrite(void *cookie, const char *buf, size_t size)
+{
+  struct pipeline *p = cookie;
+  size_t left = size;
+  while(left) {
+    size_t n;
+    if(!p->fill)
+      p->fill = ringget(&p->spare);
+    n = PIPE_BLOCK - p->fill->len;
+    if(n > left)
+      n = left;
+    memcpy(&p->fill->data[p->fill->len], buf, n);
+    p->fill->len += n;
+    buf += n;
+    left -= n;
+    if(p->fill->len == PIPE_BLOCK)
+      pipesend(p);
+  }
+  return (ssize_t)size;
+}
+
+/* write out what is processed and go back to the plain output, also on an
+   error exit */
+static void pipelinestop(struct option *o)
+{
+  struct pipeline *p = o->pipe;
+  if(!p || !pthread_equal(pthread_self(), p->main))
+    return;
+  o->pipe = NULL;
+  fclose(p->stream);
+  pipesend(p);
+  ringclose(&p->out);
+  pthread_join(p->writer, NULL);
+  o->out = p->file;
+}
+
+/* process the URLs in the --url-file with --pipeline */
+static void pipelinerun(struct option *o)
+{
+  cookie_io_functions_t io;
+  struct pipeline *p = calloc(1, sizeof(struct pipeline));
+  struct batch *b;
+  char error[sizeof(p->error)];
+  int code;
+  int i;
+
+  if(!p)
+    errorf(o, ERROR_MEM, "out of memory");
+  if(o->ranged)
+    rangestart(o, o->reader);
+  ringinit(o, &p->full, PIPE_BATCHES);
+  ringinit(o, &p->empty, PIPE_BATCHES);
+  ringinit(o, &p->out, PIPE_BLOCKS);
+  ringinit(o, &p->spare, PIPE_BLOCKS);
+  for(i = 0; i < PIPE_BATCHES; i++) {
+    p->batches[i].buf = malloc(BATCH_LINES * MAX_LINE);
+    if(!p->batches[i].buf)
+      errorf(o, ERROR_MEM, "out of memory");
+    ringput(&p->empty, &p->batches[i]);
+  }
+  for(i = 0; i < PIPE_BLOCKS; i++) {
+    struct pipeblock *k = calloc(1, sizeof(struct pipeblock));
+    if(!k)
+      errorf(o, ERROR_MEM, "out of memory");
+    ringput(&p->spare, k);
+  }
+
+  memset(&io, 0, sizeof(io));
+  io.write = pipewrite;
+  p->stream = fopencookie(p, "w", io);
+  if(!p->stream)
+    errorf(o, ERROR_MEM, "out of memory");
+  p->file = o->out;
+  p->main = pthread_self();
+  if(pthread_create(&p->writer, NULL, pipewriter, p))
+    errorf(o, ERROR_MEM, "--pipeline: failed to start thread");
+  o->out = p->stream;
+  o->pipe = p;
+  if(pthread_create(&p->reader, NULL, pipereader, o))
+    errorf(o, ERROR_MEM, "--pipeline: failed to start thread");
+
+  while((b = ringget(&p->full))) {
+    batchrun(o, b);
+    ringput(&p->empty, b);
+    if(ringempty(&p->full))
+      /* waiting for input, output what there is */
+      pipesend(p);
+  }
+  pthread_join(p->reader, NULL);
+  pipelinestop(o);
+
+  code = p->code;
+  memcpy(error, p->error, sizeof(error));
+  for(i = 0; i < PIPE_BATCHES; i++)
+    free(p->batches[i].buf);
+  while(!ringempty(&p->spare))
+    free(ringget(&p->spare));
+  ringfree(&p->full);
+  ringfree(&p->empty);
+  ringfree(&p->out);
+  ringfree(&p->spare);
+  free(p);
+  if(code)
+    errorf(o, code, "%s", error);
+}
+#endif /* SUPPORTS_PIPELINE */
+
+/* process all URLs in a --url-file, read from 'src' or o->url */
+static void urlfilerun(struct option *o, struct infile *src)
+{
+  o->reader = calloc(1, sizeof(struct urlreader));
+  if(!o->reader)
+    errorf(o, ERROR_MEM, "out of memory");
+  o->reader->src = src;
+  readerinit(o, o->reader);
+  if(o->htmlbaseuh) {
+    /* each file is a document of its own */
+    curl_url_cleanup(o->htmlbaseuh);
+    o->htmlbaseuh = NULL;
+  }
+  if(o->input == INPUT_WARC)
+    warcrun(o);
+  else if(o->input == INPUT_PCAP)
+    pcaprun(o);
+  else if(o->extract)
+    extractrun(o);
+  else if(o->html)
+    htmlrun(o);
+#ifdef SUPPORTS_PIPELINE
+  else if(o->pipeline)
+    pipelinerun(o);
+#endif
+  else
+    linerun(o);
+  readerfree(o->reader);
+  o->reader = NULL;
+}
+
+/* process one --url-file */
+static void inputrun(struct option *o, const char *name)
+{
+  FILE *f = strcmp(name, "-") ? fopen(name, "rb") : stdin;
+  if(!f)
+    errorf(o, ERROR_FILE, "--url-file %s not found", name);
+  o->url = f;
+  urlfilerun(o, NULL);
+  /* --follow might have moved on to another file */
+  if(o->url != stdin)
+    fclose(o->url);
+  o->url = NULL;
+}
+
+#ifdef HAVE_PTHREAD_H
+/* the next file to process, or NULL when all are done */
+static struct infile *inputnext(struct option *o, struct inputs *in)
+{
+  struct infile *f = NULL;
+  int i;
+  pthread_mutex_lock(&in->lock);
+  while(!f) {
+    bool left = false;
+    for(i = 0; i < in->nfiles; i++) {
+      struct infile *c = &in->files[i];
+      if(c->taken)
+        continue;
+      left = true;
+      if(o->keep_file_order || (c->started && (c->head || c->done))) {
+        f = c;
+        break;
+      }
+    }
+    if(!left)
+      break;
+    if(!f)
+      pthread_cond_wait(&in->cond, &in->lock);
+  }
+  if(f)
+    f->taken = true;
+  pthread_mutex_unlock(&in->lock);
+  return f;
+}
+
+/* process the --url-files read by reader threads */
+static void inputsthreaded(struct option *o, int nfiles)
+{
+  struct inputs in;
+  struct curl_slist *node;
+  struct infile *f;
+  int i;
+
+  memset(&in, 0, sizeof(in));
+  in.files = calloc(nfiles, sizeof(struct infile));
+  if(!in.files)
+    errorf(o, ERROR_MEM, "out of memory");
+  for(i = 0, node = o->url_files; node; node = node->next, i++) {
+    in.files[i].name = node->data;
+    in.files[i].inputs = &in;
+  }
+  in.nfiles = nfiles;
+  pthread_mutex_init(&in.lock, NULL);
+  pthread_cond_init(&in.cond, NULL);
+  for(i = 0; (i < MAX_READERS) && (i < nfiles); i++) {
+    if(pthread_create(&in.threads[i], NULL, inputthread, &in))
+      break;
+    in.nthreads++;
+  }
+  if(!in.nthreads)
+    errorf(o, ERROR_MEM, "failed to start reader threads");
+
+  for(;;) {
+    f = inputnext(o, &in);
+    if(!f)
+      break;
+    urlfilerun(o, f);
+  }
+
+  for(i = 0; i < in.nthreads; i++)
+    pthread_join(in.threads[i], NULL);
+  pthread_mutex_destroy(&in.lock);
+  pthread_cond_destroy(&in.cond);
+  free(in.files);
+}
+#endif
+
+/* process all --url-files */
+static void inputsrun(struct option *o)
+{
+  struct curl_slist *node;
+  int nfiles = 0;
+  for(node = o->url_files; node; node = node->next)
+    nfiles++;
+#ifdef HAVE_PTHREAD_H
+  if(nfiles > 1) {
+    inputsthreaded(o, nfiles);
+    return;
+  }
+#endif
+  for(node = o->url_files; node; node = node->next)
+    inputrun(o, node->data);
+}
+#endif /* !TRURL_LIBRARY */
+
+#ifndef TRURL_LIBRARY
+/*
+ * --output writes to a file. When the file name ends with .gz or .zst the
+ * output is compressed on its way out, through a stdio stream with a large
+ * buffer so that the compressor is fed big blocks. With --output-thread the
+ * compression runs in a separate thread, overlapping with the formatting of
+ * the next block.
+ */
+
+#define OUTBLOCK (1024*1024)
+#define OUTCBUF (256*1024)
+
+#ifdef SUPPORTS_COMPRESSED_OUTPUT
+struct outsink {
+  FILE *file;
+  int enc;
+  bool failed;
+  unsigned char *cbuf; /* compressed output */
+#ifdef HAVE_ZLIB_H
+  z_stream z;
+#endif
+#ifdef HAVE_ZSTD_H
+  ZSTD_CStream *zs;
+#endif
+#ifdef HAVE_PTHREAD_H
+  bool threaded;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *fill;     /* block being filled */
+  size_t filllen;
+  char *work;     /* block being compressed by the thread */
+  size_t worklen; /* zero when the thread is idle */
+  bool done;
+#endif
+};
+
+static void sinkout(struct outsink *k, size_t len)
+{
+  if(!k->failed && len && (fwrite(k->cbuf, 1, len, k->file) != len))
+    k->failed = true;
+}
+
+/* compress 'len' bytes, or finish the stream if 'finish' is set */
+static void sinkcompress(struct outsink *k, const char *data, size_t len,
+                         bool finish)
+{
+  switch(k->enc) {
+#ifdef HAVE_ZLIB_H
+  case ENC_GZIP: {
+    int rc;
+    k->z.next_in = (Bytef *)data;
+    k->z.avail_in = (uInt)len;
+    do {
+      k->z.next_out = k->cbuf;
+      k->z.avail_out = OUTCBUF;
+      rc = deflate(&k->z, finish ? Z_FINISH : Z_NO_FLUSH);
+      if(rc == Z_STREAM_ERROR) {
+        k->failed = true;
+        return;
+      }
+      sinkout(k, OUTCBUF - k->z.avail_out);
+    } while(k->z.avail_in || (finish && (rc != Z_STREAM_END)));
+    break;
+  }
+#endif
+#ifdef HAVE_ZSTD_H
+  case ENC_ZSTD: {
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    size_t rc;
+    zin.src = data;
+    zin.size = len;
+    zin.pos = 0;
+    while(zin.pos < zin.size) {
+      zout.dst = k->cbuf;
+      zout.size = OUTCBUF;
+      zout.pos = 0;
+      rc = ZSTD_compressStream(k->zs, &zout, &zin);
+      if(ZSTD_isError(rc)) {
+        k->failed = true;
+        return;
+      }
+      sinkout(k, zout.pos);
+    }
+    if(finish) {
+      do {
+        zout.dst = k->cbuf;
+        zout.size = OUTCBUF;
+        zout.pos = 0;
+        rc = ZSTD_endStream(k->zs, &zout);
+        if(ZSTD_isError(rc)) {
+          k->failed = true;
+          return;
+        }
+        sinkout(k, zout.pos);
+      } while(rc);
+    }
+    break;
+  }
+#endif
+  default:
+    (void)data;
+    (void)len;
+    (void)finish;
+    break;
+  }
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *sinkthread(void *arg)
+{
+  struct outsink *k = arg;
+  pthread_mutex_lock(&k->lock);
+  for(;;) {
+    while(!k->worklen && !k->done)
+      pthread_cond_wait(&k->cond, &k->lock);
+    if(!k->worklen)
+      break;
+    pthread_mutex_unlock(&k->lock);
+    sinkcompress(k, k->work, k->worklen, false);
+    pthread_mutex_lock(&k->lock);
+    k->worklen = 0;
+    pthread_cond_broadcast(&k->cond);
+  }
+  pthread_mutex_unlock(&k->lock);
+  return NULL;
+}
+
+/* give the filled block to the thread, once it is done with the previous */
+static void sinkhandoff(struct outsink *k)
+{
+  char *blk;
+  pthread_mutex_lock(&k->lock);
+  while(k->worklen)
+    pthread_cond_wait(&k->cond, &k->lock);
+  blk = k->work;
+  k->work = k->fill;
+  k->worklen = k->filllen;
+  k->fill = blk;
+  k->filllen = 0;
+  pthread_cond_broadcast(&k->cond);
+  pthread_mutex_unlock(&k->lock);
+}
+#endif
+
+static ssize_t sinkwrite(void *cookie, const char *buf, size_t size)
+{
+  struct outsink *k = cookie;
+#ifdef HAVE_PTHREAD_H
+  if(k->threaded) {
+    size_t left = size;
+    while(left) {
+      size_t n = OUTBLOCK - k->filllen;
+      if(n > left)
+        n = left;
+      memcpy(&k->fill[k->filllen], buf, n);
+      k->filllen += n;
+      buf += n;
+      left -= n;
+      if(k->filllen == OUTBLOCK)
+        sinkhandoff(k);
+    }
+    /* write errors show when closing */
+    return (ssize_t)size;
+  }
+#endif
+  sinkcompress(k, buf, size, false);
+  return k->failed ? -1 : (ssize_t)size;
+}
+
+static int sinkclose(void *cookie)
+{
+  struct outsink *k = cookie;
+  int rc;
+#ifdef HAVE_PTHREAD_H
+  if(k->threaded) {
+    if(k->filllen)
+      sinkhandoff(k);
+    pthread_mutex_lock(&k->lock);
+    k->done = true;
+    pthread_cond_broadcast(&k->cond);
+    pthread_mutex_unlock(&k->lock);
+    pthread_join(k->thread, NULL);
+    pthread_mutex_destroy(&k->lock);
+    pthread_cond_destroy(&k->cond);
+    free(k->fill);
+    free(k->work);
+  }
+#endif
+  sinkcompress(k, NULL, 0, true);
+  switch(k->enc) {
+#ifdef HAVE_ZLIB_H
+  case ENC_GZIP:
+    deflateEnd(&k->z);
+    break;
+#endif
+#ifdef HAVE_ZSTD_H
+  case ENC_ZSTD:
+    ZSTD_freeCStream(k->zs);
+    break;
+#endif
+  default:
+    break;
+  }
+  rc = (fclose(k->file) || k->failed) ? EOF : 0;
+  free(k->cbuf);
+  free(k);
+  return rc;
+}
+
+static FILE *sinkopen(struct option *o, FILE *file, int enc)
+{
+  cookie_io_functions_t io;
+  FILE *out;
+  struct outsink *k = calloc(1, sizeof(struct outsink));
+  if(!k)
+    errorf(o, ERROR_MEM, "out of memory");
+  k->file = file;
+  k->enc = enc;
+  k->cbuf = malloc(OUTCBUF);
+  if(!k->cbuf)
+    errorf(o, ERROR_MEM, "out of memory");
+  switch(enc) {
+#ifdef HAVE_ZLIB_H
+  case ENC_GZIP:
+    /* 16 + max window bits: gzip wrapper */
+    if(deflateInit2(&k->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                    16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      errorf(o, ERROR_MEM, "out of memory");
+    break;
+#endif
+#ifdef HAVE_ZSTD_H
+  case ENC_ZSTD:
+    k->zs = ZSTD_createCStream();
+    if(!k->zs || ZSTD_isError(ZSTD_initCStream(k->zs, 3)))
+      errorf(o, ERROR_MEM, "out of memory");
+    break;
+#endif
+  default:
+    errorf(o, ERROR_OUTPUT, "--output %s: %s compression is not supported",
+           o->output, encname(enc));
+  }
+#ifdef HAVE_PTHREAD_H
+  if(o->output_thread) {
+    k->fill = malloc(OUTBLOCK);
+    k->work = malloc(OUTBLOCK);
+    if(!k->fill || !k->work)
+      errorf(o, ERROR_MEM, "out of memory");
+    pthread_mutex_init(&k->lock, NULL);
+    pthread_cond_init(&k->cond, NULL);
+    if(pthread_create(&k->thread, NULL, sinkthread, k))
+      trurl_warnf(o, "--output-thread: failed to start thread");
+    else
+      k->threaded = true;
+  }
+#endif
+
+  memset(&io, 0, sizeof(io));
+  io.write = sinkwrite;
+  io.close = sinkclose;
+  out = fopencookie(k, "w", io);
+  if(!out)
+    errorf(o, ERROR_MEM, "out of memory");
+  return out;
+}
+#endif /* SUPPORTS_COMPRESSED_OUTPUT */
+
+#ifdef SUPPORTS_IO_URING
+/* the --output file written with --io-uring, block by block at increasing
+   offsets */
+struct uringout {
+  struct uring u;
+  FILE *file;
+  int fd;
+  char *data;
+  int state[URING_BLOCKS];
+  int res[URING_BLOCKS];  /* bytes written or -errno */
+  size_t len[URING_BLOCKS];
+  unsigned long long off[URING_BLOCKS];
+  int next;               /* the block to use next */
+  unsigned long long pos; /* the file offset of the next write */
+  int err;                /* the first write error */
+};
+
+/* handle the completion of block 'i' */
+static void uringoutdone(struct uringout *uo, int i)
+{
+  int res = uo->res[i];
+  uo->state[i] = URING_IDLE;
+  if(res < 0) {
+    if(!uo->err)
+      uo->err = -res;
+    return;
+  }
+  /* the rest of a short write */
+  while(((size_t)res < uo->len[i]) && !uo->err) {
+    ssize_t n = pwrite(uo->fd, &uo->data[(size_t)i * URING_BLOCK + res],
+                       uo->len[i] - res, (off_t)(uo->off[i] + res));
+    if(n <= 0)
+      uo->err = n ? errno : EIO;
+    else
+      res += (int)n;
+  }
+}
+
+/* wait for block 'i' to be written */
+static void uringoutwait(struct uringout *uo, int i)
+{
+  while(uo->state[i] == URING_BUSY) {
+    if(!uringwait(&uo->u, uo->state, uo->res)) {
+      /* nothing completes, give up on the writes in flight */
+      if(!uo->err)
+        uo->err = errno;
+      uo->state[i] = URING_IDLE;
+      return;
+    }
+  }
+  if(uo->state[i] == URING_DONE)
+    uringoutdone(uo, i);
+}
+
+static ssize_t uringoutwrite(void *cookie, const char *buf, size_t size)
+{
+  struct uringout *uo = cookie;
+  size_t left = size;
+  while(left && !uo->err) {
+    int i = uo->next;
+    size_t n = (left > URING_BLOCK) ? URING_BLOCK : left;
+    char *block = &uo->data[(size_t)i * URING_BLOCK];
+    uringoutwait(uo, i);
+    memcpy(block, buf, n);
+    uo->len[i] = n;
+    uo->off[i] = uo->pos;
+    uringprep(&uo->u, IORING_OP_WRITE, uo->fd, block, n, uo->pos, i);
+    if(uringenter(&uo->u, 1, 0) < 0) {
+      uo->err = errno;
+      break;
+    }
+    uo->state[i] = URING_BUSY;
+    uo->pos += n;
+    uo->next = (i + 1) % URING_BLOCKS;
+    buf += n;
+    left -= n;
+  }
+  if(uo->err) {
+    errno = uo->err;
+    return -1;
+  }
+  return (ssize_t)size;
+}
+
+static int uringoutclose(void *cookie)
+{
+  struct uringout *uo = cookie;
+  int err;
+  int i;
+  for(i = 0; i < URING_BLOCKS; i++)
+    uringoutwait(uo, i);
+  err = uo->err;
+  if(fclose(uo->file) && !err)
+    err = errno;
+  uringfree(&uo->u);
+  free(uo->data);
+  free(uo);
+  if(err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/* write the regular file that 'f' has just created with io_uring, returns
+   NULL if it cannot be done */
+static FILE *uringoutopen(FILE *f)
+{
+  struct uringout *uo;
+  cookie_io_functions_t io;
+  struct stat st;
+  FILE *out;
+  if(fstat(fileno(f), &st) || !S_ISREG(st.st_mode))
+    return NULL;
+  uo = calloc(1, sizeof(struct uringout));
+  if(!uo)
+    return NULL;
+  uo->data = malloc((size_t)URING_BLOCKS * URING_BLOCK);
+  if(!uo->data || !uringinit(&uo->u)) {
+    free(uo->data);
+    free(uo);
+    return NULL;
+  }
+  uo->file = f;
+  uo->fd = fileno(f);
+  memset(&io, 0, sizeof(io));
+  io.write = uringoutwrite;
+  io.close = uringoutclose;
+  out = fopencookie(uo, "w", io);
+  if(!out) {
+    uringfree(&uo->u);
+    free(uo->data);
+    free(uo);
+  }
+  return out;
+}
+#endif /* SUPPORTS_IO_URING */
+
+#endif /* !TRURL_LIBRARY */
+
+static bool hassuffix(const char *name, const char *suffix)
+{
+  size_t nlen = strlen(name);
+  size_t slen = strlen(suffix);
+  return (nlen > slen) && !strcmp(&name[nlen - slen], suffix);
+}
+
+#ifndef TRURL_LIBRARY
+static void outputopen(struct option *o)
+{
+  int enc = ENC_NONE;
+  FILE *f;
+
+  if(hassuffix(o->output, ".gz"))
+    enc = ENC_GZIP;
+  else if(hassuffix(o->output, ".zst"))
+    enc = ENC_ZSTD;
+  /* check for the compressor before the file is truncated */
+  switch(enc) {
+#if defined(SUPPORTS_COMPRESSED_OUTPUT) && defined(HAVE_ZLIB_H)
+  case ENC_GZIP:
+#endif
+#if defined(SUPPORTS_COMPRESSED_OUTPUT) && defined(HAVE_ZSTD_H)
+  case ENC_ZSTD:
+#endif
+  case ENC_NONE:
+    break;
+  default:
+    errorf(o, ERROR_OUTPUT, "--output %s: %s compression is not supported",
+           o->output, encname(enc));
+  }
+
+  if(o->resume && o->outsized) {
+#ifndef _MSC_VER
+    /* drop what was output after the checkpoint, it comes again */
+    if(truncate(o->output, (off_t)o->outsize) && (errno != ENOENT))
+      errorf(o, ERROR_OUTPUT, "--output %s: %s", o->output, strerror(errno));
+#endif
+    f = fopen(o->output, "ab");
+  }
+  else
+    /* without a checkpoint to continue from, the output starts over */
+    f = fopen(o->output, "wb");
+  if(!f)
+    errorf(o, ERROR_OUTPUT, "--output %s: %s", o->output, strerror(errno));
+#ifdef SUPPORTS_COMPRESSED_OUTPUT
+  if(enc != ENC_NONE) {
+    o->out = f; /* closed on error */
+    f = sinkopen(o, f, enc);
+  }
+#endif
+#ifdef SUPPORTS_IO_URING
+  /* --checkpoint needs to know what is written */
+  if(o->io_uring && (enc == ENC_NONE) && !o->checkpoint) {
+    FILE *u = uringoutopen(f);
+    if(u)
+      f = u;
+  }
+#endif
+  o->out = f;
+  setvbuf(f, NULL, _IOFBF, OUTBLOCK);
+}
+#endif /* !TRURL_LIBRARY */
+
+/* process a URL given on the command line */
+static void urlrun(struct option *o, const char *url, size_t len)
+{
+  if(o->row)
+    rowrun(o, url, len);
+  else if(o->extract) {
+    size_t from = 0;
+    extracttext(o, url, len, &from, true);
+  }
+  else {
+    struct iterinfo iinfo;
+    memset(&iinfo, 0, sizeof(iinfo));
+    singleurl(o, url, &iinfo, o->iter_list);
+  }
+}
+
+/* check the options for conflicts and prepare for the work */
+static void setupoptions(struct option *o)
+{
+  if(!o->qsep)
+    o->qsep = "&";
+
+  if(o->input) {
+    if(o->jsonout)
+      errorf(o, ERROR_FLAG, "--json cannot be used with --input-format");
+    o->row = calloc(1, sizeof(struct row));
+    if(!o->row)
+      errorf(o, ERROR_MEM, "out of memory");
+    o->row->sep = (o->input == INPUT_CSV) ? ',' : '\t';
+    o->row->keep = (o->input < INPUT_JSON) || o->json_rewrite;
+    if(!o->url_column)
+      o->url_column = 1;
+    if((o->input == INPUT_JSON) && o->json_rewrite && o->format)
+      errorf(o, ERROR_FLAG, "--input-json-rewrite cannot be used with --get");
+  }
+  else if(o->url_column)
+    errorf(o, ERROR_FLAG, "--url-column needs --input-format");
+  if(o->ranged) {
+    if(!o->url_files || o->url_files->next)
+      errorf(o, ERROR_FLAG, "--input-range and --part need one --url-file");
+    if(o->extract || o->html || (o->input >= INPUT_WARC))
+      errorf(o, ERROR_FLAG, "--input-range and --part need line input");
+  }
+  if(o->checkpoint) {
+    if(!o->url_files || o->url_files->next)
+      errorf(o, ERROR_FLAG, "--checkpoint needs one --url-file");
+    if(o->extract || o->html || (o->input >= INPUT_WARC))
+      errorf(o, ERROR_FLAG, "--checkpoint needs line input");
+    if(o->jsonout)
+      errorf(o, ERROR_FLAG, "--checkpoint cannot be used with --json");
+    if(o->output &&
+       (hassuffix(o->output, ".gz") || hassuffix(o->output, ".zst")))
+      errorf(o, ERROR_FLAG, "--checkpoint needs uncompressed --output");
+    if(o->resume)
+      checkpointload(o);
+  }
+  else if(o->resume)
+    errorf(o, ERROR_FLAG, "--resume needs --checkpoint");
+  if(o->follow) {
+#ifndef SUPPORTS_FOLLOW
+    errorf(o, ERROR_FLAG, "--follow is not supported on this platform");
+#endif
+    if(!o->url_files || o->url_files->next || !strcmp(o->url_files->data, "-"))
+      errorf(o, ERROR_FLAG, "--follow needs one --url-file");
+    if(o->extract || o->html || (o->input >= INPUT_WARC))
+      errorf(o, ERROR_FLAG, "--follow needs line input");
+    if(o->ranged)
+      errorf(o, ERROR_FLAG,
+             "--follow cannot be used with --input-range or --part");
+    if(o->jsonout)
+      errorf(o, ERROR_FLAG, "--follow cannot be used with --json");
+  }
+  if(o->pipeline) {
+#ifndef SUPPORTS_PIPELINE
+    errorf(o, ERROR_FLAG, "--pipeline is not supported on this platform");
+#endif
+    if(!o->url_files)
+      errorf(o, ERROR_FLAG, "--pipeline needs --url-file");
+    if(o->extract || o->html || (o->input >= INPUT_WARC))
+      errorf(o, ERROR_FLAG, "--pipeline needs line input");
+    if(o->checkpoint || o->follow)
+      errorf(o, ERROR_FLAG,
+             "--pipeline cannot be used with --checkpoint or --follow");
+  }
+  if(o->serve) {
+#ifndef SUPPORTS_SERVE
+    errorf(o, ERROR_FLAG, "--serve is not supported on this platform");
+#endif
+    if(o->url_list || o->url_files)
+      errorf(o, ERROR_FLAG, "--serve cannot be used with URLs or --url-file");
+    if(!o->coprocess)
+      /* the framing of the requests */
+      o->coprocess = COPROCESS_LINE;
+  }
+  if(o->coprocess) {
+#ifndef SUPPORTS_COPROCESS
+    errorf(o, ERROR_FLAG, "--coprocess is not supported on this platform");
+#endif
+    if(o->url_list || o->url_files)
+      errorf(o, ERROR_FLAG,
+             "--coprocess cannot be used with URLs or --url-file");
+  }
+  if((o->input >= INPUT_WARC) && !o->url_files)
+    errorf(o, ERROR_FLAG, "--input-format %s needs --url-file",
+           (o->input == INPUT_WARC) ? "warc" : "pcap");
+  if(o->json_rewrite && (o->input != INPUT_JSON))
+    errorf(o, ERROR_FLAG, "--input-json-rewrite needs --input-json-field");
+  if(o->extract || o->html) {
+    if(o->input)
+      errorf(o, ERROR_FLAG, "--%s cannot be used with --input-format",
+             o->extract ? "extract" : "html");
+    if(o->extract && o->html)
+      errorf(o, ERROR_FLAG, "--extract cannot be used with --html");
+  }
+  if(o->extract) {
+    o->extractuh = curl_url();
+    if(!o->extractuh)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+
+  if(o->base) {
+    CURLUcode rc;
+    o->baseuh = curl_url();
+    if(!o->baseuh)
+      errorf(o, ERROR_MEM, "out of memory");
+    rc = seturl(o, o->baseuh, o->base);
+    if(rc)
+      errorf(o, ERROR_BADURL, "invalid --base: %s [%s]",
+             curl_url_strerror(rc), o->base);
+  }
+
+  /* only process the components that can be shown */
+  o->outparts = outputparts(o);
+  fastsetup(o);
+}
+
+#if defined(TRURL_LIBRARY) || defined(SUPPORTS_COPROCESS)
+/*
+ * libtrurl, also used for the requests to --coprocess. The handle is the
+ * option struct the command line fills in, and errorf() and verify() jump
+ * back to the API call that got there instead of exiting.
+ */
+struct trurl {
+  struct option o;
+  bool ready;       /* setupoptions() is done */
+  TRURLcode setup;  /* how that went */
+  jmp_buf jump;
+  struct curl_slist *args; /* copies of the option arguments */
+  struct curl_slist *lastarg;
+};
+
+/* free what the URL had allocated when errorf() jumped back, the program
+   exit otherwise takes care of it */
+static void urlabort(struct option *o)
+{
+  curl_url_cleanup(o->uh);
+  o->uh = NULL;
+  freeqpairs(o);
+  if(o->row && o->row->cell) {
+    /* a --get value for a CSV field */
+    fclose(o->row->cell);
+    o->row->cell = NULL;
+    free(o->row->cellbuf);
+    o->row->cellbuf = NULL;
+  }
+}
+
+TRURL *trurl_init(void)
+{
+  TRURL *t = calloc(1, sizeof(TRURL));
+  if(!t)
+    return NULL;
+  if(curl_global_init(CURL_GLOBAL_ALL)) {
+    free(t);
+    return NULL;
+  }
+  t->o.delim = '\n';
+  t->o.jump = &t->jump;
+  return t;
+}
+
+/* set an option, 'usedarg' tells if 'arg' was its argument */
+static TRURLcode libsetopt(TRURL *t, const char *option, const char *arg,
+                           bool *usedarg)
+{
+  struct option *o = &t->o;
+  *usedarg = false;
+  if(setjmp(t->jump))
+    return (TRURLcode)o->errcode;
+  if(t->ready)
+    errorf(o, ERROR_FLAG, "options cannot be set after trurl_process()");
+  if(arg) {
+    /* the options keep pointing to it */
+    struct curl_slist *args = curl_slist_append(t->args, arg);
+    if(!args)
+      errorf(o, ERROR_MEM, "out of memory");
+    t->args = args;
+    t->lastarg = t->lastarg ? t->lastarg->next : args;
+    arg = t->lastarg->data;
+  }
+  /* these show something and exit */
+  if(!strcmp(option, "-h") || !strcmp(option, "--help") ||
+     !strcmp(option, "-v") || !strcmp(option, "--version") ||
+     getarg(o, option, arg, usedarg))
+    errorf(o, ERROR_FLAG, "unknown option: %s", option);
+  return TRURLE_OK;
+}
+
+/* the options that read or write files or run the program differently,
+   which a library call has no business doing */
+static const char * const libfileopts[] = {
+  "-f", "--url-file", "-o", "--output", "--html", "--rules", "--checkpoint",
+  "--resume", "--follow", "--io-uring", "--pipeline", "--output-thread",
+  "--keep-file-order", "--coprocess", "--serve", NULL
+};
+
+/* 'option' is 'name', maybe with its argument attached */
+static bool optionis(const char *option, const char *name)
+{
+  size_t len = strlen(name);
+  if(strncmp(option, name, len))
+    return false;
+  /* -fFILE or --url-file=FILE */
+  return !option[len] || (name[1] != '-') || (option[len] == '=');
+}
+
+TRURLcode trurl_setopt(TRURL *t, const char *option, const char *arg)
+{
+  bool usedarg;
+  int i;
+  for(i = 0; libfileopts[i]; i++) {
+    if(optionis(option, libfileopts[i])) {
+      curl_msnprintf(t->o.errmsg, sizeof(t->o.errmsg),
+                     "%s cannot be used with libtrurl", libfileopts[i]);
+      return TRURLE_FLAG;
+    }
+  }
+  return libsetopt(t, option, arg, &usedarg);
+}
+
+TRURLcode trurl_process(TRURL *t, const char *url, size_t len,
+                        struct trurl_buf *out)
+{
+  struct option *o = &t->o;
+  TRURLcode rc = TRURLE_OK;
+  char *data = NULL;
+  size_t size = 0;
+  char *copy = malloc(len + 1);
+  FILE *stream = open_memstream(&data, &size);
+
+  if(!t->setup)
+    /* otherwise it says why the options do not work */
+    o->errmsg[0] = 0;
+  if(!copy || !stream) {
+    free(copy);
+    if(stream)
+      fclose(stream);
+    free(data);
+    curl_msnprintf(o->errmsg, sizeof(o->errmsg), "out of memory");
+    return TRURLE_MEM;
+  }
+  memcpy(copy, url, len);
+  copy[len] = 0;
+  o->out = stream;
+
+  if(setjmp(t->jump)) {
+    rc = (TRURLcode)o->errcode;
+    if(!t->ready) {
+      /* setupoptions() failed, the options do not work */
+      t->setup = rc;
+      t->ready = true;
+    }
+    urlabort(o);
+  }
+  else {
+    if(!t->ready) {
+      setupoptions(o);
+      t->ready = true;
+    }
+    if(t->setup)
+      rc = t->setup;
+    else {
+      /* each output stands on its own, --json makes it an array */
+      o->urls = 0;
+      if(o->jsonout)
+        fputc('[', o->out);
+      urlrun(o, copy, len);
+      if(o->jsonout)
+        fprintf(o->out, "%s]\n", o->urls ? "\n" : "");
+    }
+  }
+  o->out = NULL;
+  fclose(stream);
+  free(copy);
+
+  /* a failed URL adds nothing, not even what it output before the error */
+  if(size && !rc) {
+    char *more = realloc(out->data, out->len + size + 1);
+    if(more) {
+      memcpy(&more[out->len], data, size);
+      out->len += size;
+      more[out->len] = 0;
+      out->data = more;
+    }
+    else {
+      curl_msnprintf(o->errmsg, sizeof(o->errmsg), "out of memory");
+      rc = TRURLE_MEM;
+    }
+  }
+  free(data);
+  return rc;
+}
+
+const char *trurl_strerror(TRURL *t)
+{
+  return t->o.errmsg;
+}
+
+void trurl_cleanup(TRURL *t)
+{
+  if(t) {
+    trurl_cleanup_options(&t->o);
+    curl_slist_free_all(t->args);
+    curl_global_cleanup();
+    free(t);
+  }
+}
+
+#endif
+
+#ifndef TRURL_LIBRARY
+#ifdef SUPPORTS_COPROCESS
+/*
+ * --coprocess answers requests on stdin, until its end. A request is the
+ * fields "[id]<TAB>[options]<TAB>[URL]" where the options are zero or more
+ * fields given as on the command line, like "-g<TAB>{host}". Every request
+ * is processed with the command line options and its own, as with --verify,
+ * and gets a response with its id and the exit code trurl would have had:
+ * "[id]<TAB>[code]<TAB>[output or error message]".
+ *
+ * With "line" framing, a request is a line and so is the response, with
+ * backslash, tab, CR and newline escaped in the output. With "length"
+ * framing, each request and response is a line with its length in bytes,
+ * then that many bytes and a newline. The output is then as is.
+ *
+ * Requests can be sent without waiting for the responses, which come in
+ * the same order. Output is flushed when there are no more requests to
+ * work on.
+ */
+
+#define MAX_REQUEST (1024*1024)
+#define MAX_REQFIELDS 64
+
+/* requests read from a file descriptor */
+struct requests {
+  char *buf;
+  size_t start;       /* the first unused byte */
+  size_t end;
+  size_t size;
+};
+
+struct coprocess {
+  struct option *o;   /* the command line */
+  int argc;           /* the command line options, for new handles */
+  const char **argv;
+  TRURL *base;        /* for requests without options of their own */
+  TRURL *last;        /* for the options in 'lastopts' */
+  char *lastopts;
+  size_t lastlen;
+  struct trurl_buf out;
+  FILE *resp;         /* responses go here */
+  const char *error;  /* set when the requests are not framed right */
+};
+
+/* a handle with the command line options */
+static TRURL *coprocesshandle(struct coprocess *c)
+{
+  TRURL *t = trurl_init();
+  int i;
+  bool usedarg;
+  if(!t)
+    errorf(c->o, ERROR_MEM, "out of memory");
+  for(i = 0; i < c->argc; i++) {
+    if(!strcmp(c->argv[i], "--"))
+      break;
+    /* these all worked in main() */
+    libsetopt(t, c->argv[i], (i + 1 < c->argc) ? c->argv[i + 1] : NULL,
+              &usedarg);
+    if(usedarg)
+      i++;
+  }
+  libsetopt(t, "--verify", NULL, &usedarg);
+  return t;
+}
+
+static void coprocessrespond(struct coprocess *c, const char *id, int code,
+                             const char *text, size_t len)
+{
+  FILE *out = c->resp;
+  if(c->o->coprocess == COPROCESS_LENGTH) {
+    char head[32];
+    int hlen = curl_msnprintf(head, sizeof(head), "\t%d\t", code);
+    fprintf(out, "%lu\n%s%s", (unsigned long)(strlen(id) + hlen + len), id,
+            head);
+    fwrite(text, 1, len, out);
+    fputc('\n', out);
+  }
+  else {
+    size_t i;
+    fprintf(out, "%s\t%d\t", id, code);
+    if(len && (text[len - 1] == c->o->delim))
+      /* the end of the last output */
+      len--;
+    for(i = 0; i < len; i++) {
+      switch(text[i]) {
+      case '\\':
+        fputs("\\\\", out);
+        break;
+      case '\t':
+        fputs("\\t", out);
+        break;
+      case '\r':
+        fputs("\\r", out);
+        break;
+      case '\n':
+        fputs("\\n", out);
+        break;
+      default:
+        fputc(text[i], out);
+        break;
+      }
+    }
+    fputc('\n', out);
+  }
+}
+
+/* the options a request can have, the ones that only change what is done
+   to its URL. The others could read files or make the program do
+   something else. */
+static const char * const requestopts[] = {
+  "-a", "--append", "-s", "--set", "--iterate", "--redirect", "--base",
+  "--query-separator", "--trim", "--qtrim", "-g", "--get", "--json",
+  "--verify", "--accept-space", "--curl", "--default-port", "--keep-port",
+  "--punycode", "--as-idn", "--no-guess-scheme", "--sort-query",
+  "--urlencode", "--quiet", "--replace", "--replace-append",
+  "--force-replace", "--input-format", "--url-column", "--input-json-field",
+  "--input-json-rewrite", NULL
+};
+
+static bool requestopt(const char *option)
+{
+  int i;
+  for(i = 0; requestopts[i]; i++) {
+    if(optionis(option, requestopts[i]))
+      return true;
+  }
+  return false;
+}
+
+/* the handle for the options in fields 1 to 'nopts', which are 'opts' in
+   the request, NULL after responding with the error */
+static TRURL *coprocessoptions(struct coprocess *c, const char *id,
+                               char **fields, int nopts, const char *opts,
+                               size_t olen)
+{
+  TRURLcode rc = TRURLE_OK;
+  int i;
+  if(!nopts)
+    return c->base;
+  if(c->last && (c->lastlen == olen) && !memcmp(c->lastopts, opts, olen))
+    return c->last;
+  trurl_cleanup(c->last);
+  free(c->lastopts);
+  c->lastopts = NULL;
+  c->last = coprocesshandle(c);
+  for(i = 1; (i <= nopts) && !rc; i++) {
+    bool usedarg;
+    if(fields[i][0] != '-') {
+      curl_msnprintf(c->last->o.errmsg, sizeof(c->last->o.errmsg),
+                     "not an option: %s", fields[i]);
+      rc = TRURLE_FLAG;
+      break;
+    }
+    if(!requestopt(fields[i])) {
+      curl_msnprintf(c->last->o.errmsg, sizeof(c->last->o.errmsg),
+                     "not allowed in requests: %s", fields[i]);
+      rc = TRURLE_FLAG;
+      break;
+    }
+    rc = libsetopt(c->last, fields[i], (i < nopts) ? fields[i + 1] : NULL,
+                   &usedarg);
+    if(usedarg)
+      i++;
+  }
+  if(rc) {
+    const char *msg = trurl_strerror(c->last);
+    coprocessrespond(c, id, rc, msg, strlen(msg));
+    trurl_cleanup(c->last);
+    c->last = NULL;
+    return NULL;
+  }
+  c->lastopts = malloc(olen + 1);
+  if(!c->lastopts)
+    errorf(c->o, ERROR_MEM, "out of memory");
+  memcpy(c->lastopts, opts, olen);
+  c->lastlen = olen;
+  return c->last;
+}
+
+/* work on the request in 'req', which is zero terminated */
+static void coprocessrequest(struct coprocess *c, char *req)
+{
+  char *fields[MAX_REQFIELDS];
+  char *opts = NULL;
+  size_t olen = 0;
+  int n = 0;
+  char *p = req;
+  TRURL *t;
+  TRURLcode rc;
+
+  for(;;) {
+    char *tab = strchr(p, '\t');
+    if(n == MAX_REQFIELDS) {
+      coprocessrespond(c, fields[0], ERROR_FLAG, "too many fields", 15);
+      return;
+    }
+    fields[n++] = p;
+    if(!tab)
+      break;
+    *tab = 0;
+    p = tab + 1;
+  }
+  if(n < 2) {
+    coprocessrespond(c, fields[0], ERROR_FLAG, "no URL in the request", 21);
+    return;
+  }
+  if(fields[n - 1][0] == '-') {
+    /* most likely an option that lost its argument */
+    char msg[80];
+    curl_msnprintf(msg, sizeof(msg), "not a URL: %s", fields[n - 1]);
+    coprocessrespond(c, fields[0], ERROR_FLAG, msg, strlen(msg));
+    return;
+  }
+  if(n > 2) {
+    /* the options as they are, to compare with the previous request */
+    opts = fields[1];
+    olen = (size_t)(fields[n - 1] - 1 - opts);
+  }
+  t = coprocessoptions(c, fields[0], fields, n - 2, opts, olen);
+  if(!t)
+    return;
+  c->out.len = 0;
+  rc = trurl_process(t, fields[n - 1], strlen(fields[n - 1]), &c->out);
+  if(rc) {
+    const char *msg = trurl_strerror(t);
+    coprocessrespond(c, fields[0], rc, msg, strlen(msg));
+  }
+  else
+    coprocessrespond(c, fields[0], rc, c->out.data ? c->out.data : "",
+                     c->out.len);
+}
+
+/* the next complete request in 'r', zero terminated, or NULL. Sets
+   c->error if the requests are not framed right */
+static char *coprocessnext(struct coprocess *c, struct requests *r, bool eof)
+{
+  char *req = &r->buf[r->start];
+  size_t avail = r->end - r->start;
+  char *nl = avail ? memchr(req, '\n', avail) : NULL;
+  if(c->o->coprocess == COPROCESS_LENGTH) {
+    unsigned long len = 0;
+    char *p;
+    if(!nl) {
+      if(eof && avail)
+        c->error = "incomplete request";
+      return NULL;
+    }
+    for(p = req; p < nl; p++) {
+      if((*p < '0') || (*p > '9') || (len > MAX_REQUEST))
+        break;
+      len = len * 10 + (unsigned long)(*p - '0');
+    }
+    if((p != nl) || (p == req) || (len > MAX_REQUEST)) {
+      c->error = "bad request length";
+      return NULL;
+    }
+    /* the request and its newline */
+    if((size_t)(nl + 1 - req) + len + 1 > avail) {
+      if(eof)
+        c->error = "incomplete request";
+      return NULL;
+    }
+    req = nl + 1;
+    nl = req + len;
+    if(*nl != '\n') {
+      c->error = "no newline after the request";
+      return NULL;
+    }
+  }
+  else if(!nl) {
+    if(!eof || !avail)
+      return NULL;
+    /* the last line without a newline */
+    nl = &req[avail];
+  }
+  else if((nl > req) && (nl[-1] == '\r'))
+    nl[-1] = 0;
+  r->start = (size_t)(nl - r->buf) + 1;
+  if(r->start > r->end)
+    /* there is always room for this zero */
+    r->start = r->end;
+  *nl = 0;
+  return req;
+}
+
+/* answer the complete requests in 'r' */
+static void coprocessanswer(struct coprocess *c, struct requests *r,
+                            bool eof)
+{
+  char *req;
+  while((req = coprocessnext(c, r, eof)))
+    if(*req)
+      coprocessrequest(c, req);
+}
+
+/* make room in 'r' and read more requests from 'fd'. Returns what read()
+   does, or -1 with c->error set when a request is too large */
+static ssize_t requestsread(struct coprocess *c, struct requests *r, int fd)
+{
+  ssize_t n;
+  if(r->start) {
+    memmove(r->buf, &r->buf[r->start], r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if(r->end == r->size) {
+    size_t size = r->size ? r->size * 2 : 4096;
+    char *more;
+    if(r->size >= MAX_REQUEST + 32) {
+      c->error = "too large request";
+      return -1;
+    }
+    more = realloc(r->buf, size + 1);
+    if(!more)
+      errorf(c->o, ERROR_MEM, "out of memory");
+    r->buf = more;
+    r->size = size;
+  }
+  do
+    n = read(fd, &r->buf[r->end], r->size - r->end);
+  while((n < 0) && (errno == EINTR));
+  if(n > 0)
+    r->end += (size_t)n;
+  return n;
+}
+
+static void coprocessinit(struct coprocess *c, struct option *o, int argc,
+                          const char **argv)
+{
+  memset(c, 0, sizeof(*c));
+  c->o = o;
+  c->argc = argc;
+  c->argv = argv;
+  c->base = coprocesshandle(c);
+}
+
+static void coprocessfree(struct coprocess *c)
+{
+  trurl_cleanup(c->base);
+  trurl_cleanup(c->last);
+  free(c->lastopts);
+  free(c->out.data);
+}
+
+static void coprocessrun(struct option *o, int argc, const char **argv)
+{
+  struct coprocess c;
+  struct requests r;
+  memset(&r, 0, sizeof(r));
+  coprocessinit(&c, o, argc, argv);
+  c.resp = o->out;
+
+  for(;;) {
+    ssize_t n;
+    coprocessanswer(&c, &r, false);
+    /* nothing more to do until there is more input */
+    fflush(o->out);
+    if(c.error)
+      break;
+    n = requestsread(&c, &r, STDIN_FILENO);
+    if(n <= 0) {
+      if((n < 0) && !c.error)
+        trurl_warnf(o, "read: %s", strerror(errno));
+      if(!c.error)
+        coprocessanswer(&c, &r, true);
+      break;
+    }
+  }
+  if(c.error)
+    errorf(o, ERROR_FLAG, "--coprocess: %s", c.error);
+  coprocessfree(&c);
+  free(r.buf);
+}
+#endif /* SUPPORTS_COPROCESS */
+
+#ifdef SUPPORTS_SERVE
+/*
+ * --serve answers the requests of --coprocess on a Unix socket, for any
+ * number of clients at once. SERVE_WORKERS threads wait with epoll for new
+ * connections and for the ones they have accepted. The connections of a
+ * worker share its handles, so requests with the same options from
+ * different clients reuse them.
+ *
+ * A connection is not read from while it has responses left to send, so a
+ * client that does not read cannot make them grow. On SIGTERM or SIGINT,
+ * the workers stop accepting and reading, send the responses to the
+ * requests they have read and close. A second signal ends trurl at once.
+ */
+
+#define SERVE_WORKERS 4
+#define SERVE_EVENTS 64
+
+struct conn {
+  struct conn *next;
+  struct conn *prev;
+  int fd;
+  uint32_t events;    /* what epoll waits for */
+  bool eof;           /* no more requests */
+  struct requests in;
+  char *resp;         /* responses to send */
+  size_t resplen;
+  size_t sent;
+};
+
+struct server;
+
+struct worker {
+  struct server *s;
+  pthread_t thread;
+  int epfd;
+  bool draining;
+  struct coprocess c;
+  struct conn *conns;
+};
+
+struct server {
+  struct option *o;
+  int fd;             /* listening */
+  int stopfd;         /* an eventfd, readable when it is time to stop */
+  struct worker workers[SERVE_WORKERS];
+};
+
+/* for the signal handler */
+static int servestopfd = -1;
+static volatile sig_atomic_t servestopping;
+
+static void servesignal(int sig)
+{
+  uint64_t one = 1;
+  ssize_t rc;
+  (void)sig;
+  if(servestopping)
+    _exit(1);
+  servestopping = 1;
+  rc = write(servestopfd, &one, sizeof(one));
+  (void)rc;
+}
+
+static void connclose(struct worker *w, struct conn *k)
+{
+  if(k->prev)
+    k->prev->next = k->next;
+  else
+    w->conns = k->next;
+  if(k->next)
+    k->next->prev = k->prev;
+  close(k->fd); /* which also removes it from epoll */
+  free(k->in.buf);
+  free(k->resp);
+  free(k);
+}
+
+/* send what is left of the responses, false if the connection broke */
+static bool connsend(struct conn *k)
+{
+  while(k->sent < k->resplen) {
+    ssize_t n = send(k->fd, &k->resp[k->sent], k->resplen - k->sent,
+                     MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+    k->sent += (size_t)n;
+  }
+  return true;
+}
+
+/* read from the connection if it can be read, answer the requests and send
+   the responses. Closes the connection when it is done. */
+static void connrun(struct worker *w, struct conn *k, bool readable)
+{
+  struct coprocess *c = &w->c;
+  uint32_t events = EPOLLIN;
+
+  if(!connsend(k)) {
+    connclose(w, k);
+    return;
+  }
+  if(k->sent == k->resplen) {
+    if(readable && !k->eof && !w->draining) {
+      ssize_t n = requestsread(c, &k->in, k->fd);
+      if(!n)
+        k->eof = true;
+      else if((n < 0) && !c->error &&
+              (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        connclose(w, k);
+        return;
+      }
+    }
+    free(k->resp);
+    k->resp = NULL;
+    k->resplen = k->sent = 0;
+    c->resp = open_memstream(&k->resp, &k->resplen);
+    if(!c->resp)
+      errorf(c->o, ERROR_MEM, "out of memory");
+    coprocessanswer(c, &k->in, k->eof);
+    if(fclose(c->resp))
+      errorf(c->o, ERROR_MEM, "out of memory");
+    c->resp = NULL;
+    if(c->error) {
+      /* the client sends something else than requests */
+      c->error = NULL;
+      connclose(w, k);
+      return;
+    }
+    if(!connsend(k)) {
+      connclose(w, k);
+      return;
+    }
+  }
+  if(k->sent < k->resplen)
+    events = EPOLLOUT;
+  else if(k->eof || w->draining) {
+    connclose(w, k);
+    return;
+  }
+  if(events != k->events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = k;
+    if(epoll_ctl(w->epfd, EPOLL_CTL_MOD, k->fd, &ev)) {
+      connclose(w, k);
+      return;
+    }
+    k->events = events;
+  }
+}
+
+static void serveaccept(struct worker *w)
+{
+  for(;;) {
+    struct epoll_event ev;
+    struct conn *k;
+    int fd = accept4(w->s->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) {
+      if(errno == EINTR)
+        continue;
+      if((errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+         (errno != ECONNABORTED))
+        trurl_warnf(w->s->o, "accept: %s", strerror(errno));
+      return;
+    }
+    k = calloc(1, sizeof(*k));
+    if(!k)
+      errorf(w->s->o, ERROR_MEM, "out of memory");
+    k->fd = fd;
+    k->events = EPOLLIN;
+    k->next = w->conns;
+    if(w->conns)
+      w->conns->prev = k;
+    w->conns = k;
+    ev.events = EPOLLIN;
+    ev.data.ptr = k;
+    if(epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev))
+      connclose(w, k);
+  }
+}
+
+/* stop accepting and reading, and close the connections with nothing left
+   to send */
+static void servedrain(struct worker *w)
+{
+  struct conn *k = w->conns;
+  w->draining = true;
+  epoll_ctl(w->epfd, EPOLL_CTL_DEL, w->s->fd, NULL);
+  epoll_ctl(w->epfd, EPOLL_CTL_DEL, w->s->stopfd, NULL);
+  while(k) {
+    struct conn *next = k->next;
+    connrun(w, k, false);
+    k = next;
+  }
+}
+
+static void *serveworker(void *arg)
+{
+  struct worker *w = arg;
+  struct epoll_event ev[SERVE_EVENTS];
+  while(!w->draining || w->conns) {
+    bool stop = false;
+    int i;
+    int n = epoll_wait(w->epfd, ev, SERVE_EVENTS, -1);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      errorf(w->s->o, ERROR_FILE, "epoll_wait: %s", strerror(errno));
+    }
+    for(i = 0; i < n; i++) {
+      if(ev[i].data.ptr == &w->s->fd)
+        serveaccept(w);
+      else if(ev[i].data.ptr == &w->s->stopfd)
+        /* after the other events, which may be for connections it closes */
+        stop = true;
+      else
+        connrun(w, ev[i].data.ptr,
+                !!(ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)));
+    }
+    if(stop)
+      servedrain(w);
+  }
+  return NULL;
+}
+
+/* listen on the Unix socket 'path' */
+static int servelisten(struct option *o, const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  size_t len = strlen(path);
+  int fd;
+  if(len >= sizeof(addr.sun_path))
+    errorf(o, ERROR_FLAG, "--serve: too long socket path: %s", path);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, len);
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    errorf(o, ERROR_FILE, "--serve: socket: %s", strerror(errno));
+  if(!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+    /* left by an earlier server if nothing answers there */
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if((probe >= 0) &&
+       connect(probe, (struct sockaddr *)&addr, sizeof(addr)) &&
+       (errno == ECONNREFUSED))
+      unlink(path);
+    if(probe >= 0)
+      close(probe);
+  }
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+     listen(fd, SOMAXCONN))
+    errorf(o, ERROR_FILE, "--serve %s: %s", path, strerror(errno));
+  return fd;
+}
+
+static void serverun(struct option *o, int argc, const char **argv)
+{
+  struct server s;
+  struct sigaction sa;
+  int nworkers = 0;
+  int i;
+  memset(&s, 0, sizeof(s));
+  s.o = o;
+  s.fd = servelisten(o, o->serve);
+  s.stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(s.stopfd < 0)
+    errorf(o, ERROR_FILE, "--serve: eventfd: %s", strerror(errno));
+  servestopfd = s.stopfd;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = servesignal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  for(i = 0; i < SERVE_WORKERS; i++) {
+    struct worker *w = &s.workers[i];
+    struct epoll_event ev;
+    w->s = &s;
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(w->epfd < 0)
+      break;
+    /* only one of the workers wakes up for a new connection */
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &s.fd;
+    if(!epoll_ctl(w->epfd, EPOLL_CTL_ADD, s.fd, &ev)) {
+      ev.events = EPOLLIN;
+      ev.data.ptr = &s.stopfd;
+      if(!epoll_ctl(w->epfd, EPOLL_CTL_ADD, s.stopfd, &ev)) {
+        coprocessinit(&w->c, o, argc, argv);
+        if(!pthread_create(&w->thread, NULL, serveworker, w)) {
+          nworkers++;
+          continue;
+        }
+        coprocessfree(&w->c);
+      }
+    }
+    close(w->epfd);
+    break;
+  }
+  if(!nworkers)
+    errorf(o, ERROR_MEM, "failed to start --serve workers");
+
+  for(i = 0; i < nworkers; i++) {
+    pthread_join(s.workers[i].thread, NULL);
+    coprocessfree(&s.workers[i].c);
+    close(s.workers[i].epfd);
+  }
+  close(s.fd);
+  close(s.stopfd);
+  unlink(o->serve);
+}
+#endif /* SUPPORTS_SERVE */
+
+int main(int argc, const char **argv)
+{
+  int exit_status = 0;
+  struct option o;
+  struct curl_slist *node;
+  int optc = argc - 1; /* the options, for --coprocess */
+  const char **optv = &argv[1];
+  memset(&o, 0, sizeof(o));
+  o.delim = '\n';
+  setlocale(LC_ALL, "");
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  for(argc--, argv++; argc > 0; argc--, argv++) {
+    bool usedarg = false;
+    if(!o.end_of_options && argv[0][0] == '-') {
+      /* dash-dash prefixed */
+      if(getarg(&o, argv[0], argv[1], &usedarg)) {
+        /* if the long option ends with an equals sign, cut it there,
            if it is a short option, show just two letters */
         size_t not_e = argv[0][1] == '-' ? strcspn(argv[0], "=") : 2;
         errorf(&o, ERROR_FLAG, "unknown option: %.*s", (int)not_e, argv[0]);
@@ -2047,75 +9149,45 @@ int main(int argc, const char **argv)
       argv++;
     }
   }
-  if(!o.qsep)
-    o.qsep = "&";
+  setupoptions(&o);
+
+  o.out = stdout;
+  if(o.output)
+    outputopen(&o);
+
+#ifdef SUPPORTS_COPROCESS
+  if(o.coprocess) {
+#ifdef SUPPORTS_SERVE
+    if(o.serve)
+      serverun(&o, optc, optv);
+    else
+#endif
+      coprocessrun(&o, optc, optv);
+    if(fclose(o.out))
+      errorf(&o, ERROR_OUTPUT, "failed writing %s",
+             o.output ? o.output : "responses");
+    o.out = NULL;
+    trurl_cleanup_options(&o);
+    curl_global_cleanup();
+    return 0;
+  }
+#else
+  (void)optc;
+  (void)optv;
+#endif
 
   if(o.jsonout)
-    putchar('[');
-
-  if(o.url) {
-    /* this is a file to read URLs from */
-    char buffer[4096]; /* arbitrary max */
-    bool end_of_file = false;
-    while(!end_of_file && fgets(buffer, sizeof(buffer), o.url)) {
-      char *eol = strchr(buffer, '\n');
-      if(eol && (eol > buffer)) {
-        if(eol[-1] == '\r')
-          /* CRLF detected */
-          eol--;
-      }
-      else if(eol == buffer) {
-        /* empty line */
-        continue;
-      }
-      else if(feof(o.url)) {
-        /* end of file */
-        eol = strlen(buffer) + buffer;
-        end_of_file = true;
-      }
-      else {
-        /* line too long */
-        int ch;
-        trurl_warnf(&o, "skipping long line");
-        do {
-          ch = getc(o.url);
-        } while(ch != EOF && ch != '\n');
-        if(ch == EOF) {
-          if(ferror(o.url))
-            trurl_warnf(&o, "getc: %s", strerror(errno));
-          end_of_file = true;
-        }
-        continue;
-      }
-
-      /* trim trailing spaces and tabs */
-      while((eol > buffer) &&
-            ((eol[-1] == ' ') || eol[-1] == '\t'))
-        eol--;
-
-      if(eol > buffer) {
-        /* if there is actual content left to deal with */
-        struct iterinfo iinfo;
-        memset(&iinfo, 0, sizeof(iinfo));
-        *eol = 0; /* end of URL */
-        singleurl(&o, buffer, &iinfo, o.iter_list);
-      }
-    }
+    fputc('[', o.out);
 
-    if(!end_of_file && ferror(o.url))
-      trurl_warnf(&o, "fgets: %s", strerror(errno));
-    if(o.urlopen)
-      fclose(o.url);
-  }
+  if(o.url_files)
+    /* files to read URLs from */
+    inputsrun(&o);
   else {
     /* not reading URLs from a file */
     node = o.url_list;
     do {
       if(node) {
-        const char *url = node->data;
-        struct iterinfo iinfo;
-        memset(&iinfo, 0, sizeof(iinfo));
-        singleurl(&o, url, &iinfo, o.iter_list);
+        urlrun(&o, node->data, strlen(node->data));
         node = node->next;
       }
       else {
@@ -2127,9 +9199,16 @@ int main(int argc, const char **argv)
     } while(node);
   }
   if(o.jsonout)
-    printf("%s]\n", o.urls ? "\n" : "");
+    fprintf(o.out, "%s]\n", o.urls ? "\n" : "");
+  if(o.out != stdout) {
+    FILE *out = o.out;
+    o.out = NULL;
+    if(fclose(out))
+      errorf(&o, ERROR_OUTPUT, "failed writing %s", o.output);
+  }
   /* we're done with libcurl, so clean it up */
   trurl_cleanup_options(&o);
   curl_global_cleanup();
   return exit_status;
 }
+#endif /* !TRURL_LIBRARY */